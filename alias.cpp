@@ -0,0 +1,81 @@
+/*
+  Copyright 2008-2013 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*!
+  \file alias.cpp
+
+  \brief Alias table construction (Vose's method).
+ */
+
+#include "alias.hpp"
+
+bool alias_table::build(const std::vector<double> &weights)
+{
+  unsigned int n = weights.size(), i;
+  double W = 0.0;
+  for(i = 0; i < n; ++i)
+    if(weights[i] > 0.0)
+      W += weights[i];
+  if(n == 0 || W <= 0.0)
+    return false;
+
+  prob.assign(n, 1.0f);
+  alias.resize(n);
+
+  // scale so the average weight is 1, then split the outcomes into
+  // those below and above average
+  std::vector<double> scaled(n);
+  std::vector<uint32_t> small, large;
+  for(i = 0; i < n; ++i) {
+    scaled[i] = (weights[i] > 0.0 ? weights[i] : 0.0) * n / W;
+    alias[i] = i;
+    if(scaled[i] < 1.0)
+      small.push_back(i);
+    else
+      large.push_back(i);
+  }
+
+  // fill each below-average cell up to 1 with a piece of an
+  // above-average outcome, which then has that much less to give
+  while(!small.empty() && !large.empty()) {
+    uint32_t s = small.back(), l = large.back();
+    small.pop_back();
+    prob[s] = scaled[s];
+    alias[s] = l;
+    scaled[l] -= 1.0 - scaled[s];
+    if(scaled[l] < 1.0) {
+      large.pop_back();
+      small.push_back(l);
+    }
+  }
+
+  // whatever is left over is (up to rounding) exactly average
+  for(i = 0; i < small.size(); ++i)
+    prob[small[i]] = 1.0f;
+  for(i = 0; i < large.size(); ++i)
+    prob[large[i]] = 1.0f;
+
+  return true;
+}
@@ -0,0 +1,68 @@
+/*
+  Copyright 2008-2013 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*!
+  \file alias.hpp
+
+  \brief Walker/Vose alias table, for drawing from a fixed discrete
+  distribution in constant time however many outcomes there are.
+  Each outcome i gets a cell holding the probability of keeping i and
+  an alias to return otherwise, so a draw is one random number, one
+  multiply and one comparison.  Takes 8 bytes per outcome.
+ */
+
+#ifndef _ALIAS_HPP
+#define _ALIAS_HPP
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+
+class alias_table
+{
+public:
+  // build the table from the given weights, which needn't be
+  // normalized; returns false if there are no positive weights
+  bool build(const std::vector<double> &weights);
+
+  unsigned int size() const { return prob.size(); }
+
+  // draw an outcome using (and advancing) the given erand48 state;
+  // the integer part of a uniform draw on [0, n) picks the cell, and
+  // the fractional part decides between the cell and its alias
+  unsigned int sample(unsigned short rng[3]) const
+  {
+    double u = erand48(rng) * prob.size();
+    unsigned int i = (unsigned int)u;
+    if(i >= prob.size()) // paranoia about rounding
+      i = prob.size() - 1;
+    return u - i < prob[i] ? i : alias[i];
+  }
+
+  std::vector<float> prob;
+  std::vector<uint32_t> alias;
+};
+
+#endif // _ALIAS_HPP
@@ -0,0 +1,189 @@
+/*
+  Copyright 2008-2013 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*!
+  \file cacherules.cpp
+
+  \brief Cache hit/miss rules: implementation details.
+ */
+
+#include "cacherules.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+
+const char *cache_verdict_names[CACHE_VERDICTS] = { "unknown", "hit", "miss" };
+
+cache_rules::cache_rules()
+{
+}
+
+cache_rules::~cache_rules()
+{
+  clear();
+}
+
+void cache_rules::clear()
+{
+  for(size_t i = 0; i < rules.size(); ++i) {
+    regfree(&rules[i]->re);
+    delete rules[i];
+  }
+  rules.clear();
+}
+
+void cache_rules::copy(const cache_rules &from)
+{
+  clear();
+  std::string error;
+  for(size_t i = 0; i < from.rules.size(); ++i)
+    add(from.rules[i]->text.c_str(), error); // compiled once already
+}
+
+bool cache_rules::add(const char *rule, std::string &error)
+{
+  const char *p = rule;
+  std::string field[2];
+  for(int f = 0; f < 2; ++f) {
+    while(isspace((unsigned char)*p))
+      ++p;
+    const char *end = p;
+    while(*end && !isspace((unsigned char)*end))
+      ++end;
+    field[f].assign(p, end - p);
+    p = end;
+  }
+  while(isspace((unsigned char)*p))
+    ++p;
+  std::string pattern(p);
+  while(!pattern.empty() && isspace((unsigned char)pattern[pattern.length() - 1]))
+    pattern.erase(pattern.length() - 1);
+
+  int verdict;
+  if(!strcasecmp(field[0].c_str(), "hit"))
+    verdict = CACHE_HIT;
+  else if(!strcasecmp(field[0].c_str(), "miss"))
+    verdict = CACHE_MISS;
+  else {
+    error = "rule doesn't start with hit or miss: " + std::string(rule);
+    return false;
+  }
+  if(field[1].empty() || pattern.empty()) {
+    error = "rule needs a header and a pattern: " + std::string(rule);
+    return false;
+  }
+
+  rule_t *r = new rule_t;
+  r->text = rule;
+  r->verdict = verdict;
+  r->header = field[1];
+  int e = regcomp(&r->re, pattern.c_str(), REG_EXTENDED | REG_ICASE | REG_NOSUB);
+  if(e) {
+    char buf[256];
+    regerror(e, &r->re, buf, sizeof(buf));
+    error = std::string(buf) + ": " + pattern;
+    delete r;
+    return false;
+  }
+  rules.push_back(r);
+  return true;
+}
+
+bool cache_rules::load(const char *file, std::string &error)
+{
+  FILE *f = fopen(file, "r");
+  if(!f) {
+    error = strerror(errno);
+    return false;
+  }
+  char line[1024];
+  while(fgets(line, sizeof(line), f)) {
+    const char *p = line;
+    while(isspace((unsigned char)*p))
+      ++p;
+    if(*p == 0 || *p == '#')
+      continue;
+    line[strcspn(line, "\r\n")] = 0;
+    if(!add(p, error)) {
+      fclose(f);
+      return false;
+    }
+  }
+  fclose(f);
+  if(rules.empty()) {
+    error = "no rules";
+    return false;
+  }
+  return true;
+}
+
+void cache_rules::defaults()
+{
+  // proxies in a chain each tack on their own status ("MISS, HIT"),
+  // and the one nearest us answered, so a hit anywhere counts; nginx
+  // serving stale content is still serving from cache
+  static const char *builtin[] = {
+    "hit X-Cache HIT",
+    "miss X-Cache MISS",
+    "hit X-Cache-Status HIT|STALE|UPDATING|REVALIDATED",
+    "miss X-Cache-Status MISS|EXPIRED|BYPASS",
+    "hit CF-Cache-Status HIT|STALE|REVALIDATED|UPDATING",
+    "miss CF-Cache-Status MISS|EXPIRED|BYPASS|DYNAMIC",
+    "hit Age ^[0-9]*[1-9]"
+  };
+  std::string error;
+  for(size_t i = 0; i < sizeof(builtin) / sizeof(builtin[0]); ++i)
+    add(builtin[i], error);
+}
+
+void cache_rules::classify(const char *line, size_t len, int &rule, int &verdict) const
+{
+  const char *colon = (const char *)memchr(line, ':', len);
+  if(!colon)
+    return; // the status line, or the blank one at the end
+  size_t name_len = colon - line;
+  const char *v = colon + 1, *end = line + len;
+  while(v < end && (*v == ' ' || *v == '\t'))
+    ++v;
+  while(end > v && (end[-1] == '\r' || end[-1] == '\n' || end[-1] == ' ' || end[-1] == '\t'))
+    --end;
+
+  size_t last = rule < 0 ? rules.size() : (size_t)rule;
+  for(size_t i = 0; i < last; ++i) {
+    const rule_t &r = *rules[i];
+    if(r.header.length() != name_len || strncasecmp(r.header.c_str(), line, name_len))
+      continue;
+    regmatch_t m;
+    m.rm_so = 0;
+    m.rm_eo = end - v;
+    if(regexec(&r.re, v, 1, &m, REG_STARTEND) == 0) {
+      rule = i;
+      verdict = r.verdict;
+      return;
+    }
+  }
+}
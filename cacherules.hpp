@@ -0,0 +1,103 @@
+/*
+  Copyright 2008-2013 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*!
+  \file cacherules.hpp
+
+  \brief Rules for telling a cache hit from a miss by the response
+  headers.  A rule names a header, a POSIX extended regular expression
+  (matched without regard to case) and the verdict when the header's
+  value matches it, e.g.
+
+    hit   X-Cache   HIT
+    miss  X-Cache   MISS
+    hit   Age       ^[1-9]
+
+  Rules are checked against each header as it arrives, in place: the
+  header isn't copied or NUL-terminated first (this uses glibc's
+  REG_STARTEND).  When several rules match a response, the one listed
+  first wins, whatever order the headers came in.
+ */
+
+#ifndef _CACHERULES_HPP
+#define _CACHERULES_HPP
+
+#include <stddef.h>
+#include <regex.h>
+#include <string>
+#include <vector>
+
+// what the rules made of a response
+enum { CACHE_UNKNOWN, CACHE_HIT, CACHE_MISS, CACHE_VERDICTS };
+
+class cache_rules
+{
+public:
+  cache_rules();
+  ~cache_rules();
+
+  // read rules from a file, one per line: verdict (hit or miss),
+  // header name, and the rest of the line is the regex; blank lines
+  // and lines starting with '#' are skipped.  returns false (with the
+  // reason in error) if a rule can't be parsed.
+  bool load(const char *file, std::string &error);
+
+  // the rules for the usual caches' headers (X-Cache, X-Cache-Status,
+  // CF-Cache-Status, Age)
+  void defaults();
+
+  // add a single rule, in the same form as a line of the file
+  bool add(const char *rule, std::string &error);
+
+  // compile the same rules again (from their text), replacing these
+  void copy(const cache_rules &from);
+
+  bool empty() const { return rules.empty(); }
+
+  // look at one header line as curl hands it over ("Name: value\r\n",
+  // not NUL-terminated); if it matches a rule listed before rule (the
+  // best match so far, or -1 for none), update rule and verdict.
+  // glibc's regexec locks the regex_t it's given, so threads that
+  // classify at the same time should each have their own copy().
+  void classify(const char *line, size_t len, int &rule, int &verdict) const;
+
+private:
+  struct rule_t {
+    std::string text;    // as it was given to add()
+    int verdict;
+    std::string header;
+    regex_t re;
+  };
+  std::vector<rule_t *> rules;
+
+  void clear();
+
+  cache_rules(const cache_rules &);
+  cache_rules & operator=(const cache_rules &);
+};
+
+extern const char *cache_verdict_names[CACHE_VERDICTS];
+
+#endif // _CACHERULES_HPP
@@ -0,0 +1,136 @@
+/*
+  Copyright 2008-2013 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*!
+  \file histogram.cpp
+
+  \brief Log-linear latency histogram: implementation details.
+ */
+
+#include "histogram.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+const char *latency_names[LAT_PHASES] = { "dns", "connect", "first byte", "total" };
+
+histogram::histogram()
+{
+  clear();
+}
+
+unsigned int histogram::index(uint64_t v)
+{
+  if(v >= (1ULL << max_bits))
+    v = (1ULL << max_bits) - 1;
+  if(v < sub_count)
+    return v;
+  // position of the highest bit decides the power of two; the next
+  // sub_bits - 1 bits pick the bucket within it
+  unsigned int shift = 63 - __builtin_clzll(v) - (sub_bits - 1);
+  return shift * half_count + (v >> shift);
+}
+
+uint64_t histogram::highest_equivalent(unsigned int i)
+{
+  if(i < sub_count)
+    return i;
+  unsigned int shift = i / half_count - 1;
+  uint64_t m = i - shift * half_count;
+  return ((m + 1) << shift) - 1;
+}
+
+void histogram::snapshot(histogram &out) const
+{
+  for(unsigned int i = 0; i < bucket_count; ++i)
+    out.counts[i] = __atomic_load_n(&counts[i], __ATOMIC_RELAXED);
+  // recount rather than trusting total, which may have been bumped
+  // before or after the bucket we just read
+  out.total = 0;
+  for(unsigned int i = 0; i < bucket_count; ++i)
+    out.total += out.counts[i];
+  out.sum = __atomic_load_n(&sum, __ATOMIC_RELAXED);
+}
+
+void histogram::clear()
+{
+  memset(counts, 0, sizeof(counts));
+  total = 0;
+  sum = 0;
+}
+
+void histogram::add(const histogram &h)
+{
+  for(unsigned int i = 0; i < bucket_count; ++i)
+    counts[i] += h.counts[i];
+  total += h.total;
+  sum += h.sum;
+}
+
+void histogram::subtract(const histogram &h)
+{
+  for(unsigned int i = 0; i < bucket_count; ++i)
+    counts[i] -= h.counts[i];
+  total -= h.total;
+  sum -= h.sum;
+}
+
+uint64_t histogram::percentile(double p) const
+{
+  if(total == 0)
+    return 0;
+  uint64_t rank = (uint64_t)ceil(p / 100.0 * total), seen = 0;
+  if(rank < 1)
+    rank = 1;
+  for(unsigned int i = 0; i < bucket_count; ++i) {
+    seen += counts[i];
+    if(seen >= rank)
+      return highest_equivalent(i);
+  }
+  return max();
+}
+
+uint64_t histogram::max() const
+{
+  for(int i = bucket_count - 1; i >= 0; --i)
+    if(counts[i])
+      return highest_equivalent(i);
+  return 0;
+}
+
+uint64_t histogram::count_at_most(uint64_t v) const
+{
+  uint64_t c = 0;
+  for(unsigned int i = 0; i < bucket_count && highest_equivalent(i) <= v; ++i)
+    c += counts[i];
+  return c;
+}
+
+void format_latency(const histogram &h, char *buf, size_t len)
+{
+  snprintf(buf, len, "%.3f/%.3f/%.3f/%.3f/%.3f",
+           h.percentile(50.0) / 1000.0, h.percentile(90.0) / 1000.0, h.percentile(99.0) / 1000.0,
+           h.percentile(99.9) / 1000.0, h.max() / 1000.0);
+}
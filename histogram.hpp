@@ -0,0 +1,107 @@
+/*
+  Copyright 2008-2013 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*!
+  \file histogram.hpp
+
+  \brief Log-linear histogram of non-negative integer values (we use
+  microseconds), in the style of HdrHistogram: values below 128 get a
+  bucket each, and above that every power of two is split into 64
+  buckets, so any recorded value is known to within 1/64 of itself.
+  Values up to about 19 hours (in microseconds) fit in a fixed array of
+  counters; bigger ones are clamped.
+
+  A histogram has a single writer (the worker thread that owns it),
+  which records with plain atomic stores, and can be copied by other
+  threads at any time with snapshot(); interval statistics come from
+  subtracting successive snapshots.
+ */
+
+#ifndef _HISTOGRAM_HPP
+#define _HISTOGRAM_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+class histogram
+{
+public:
+  enum {
+    sub_bits = 7,
+    sub_count = 1 << sub_bits,     // buckets below the first power of two split
+    half_count = sub_count / 2,    // buckets per power of two above that
+    max_bits = 36,                 // values up to 2^36 - 1
+    bucket_count = (max_bits - sub_bits + 2) * half_count
+  };
+
+  histogram();
+
+  // record a value; only the owning thread may call this
+  void record(uint64_t v)
+  {
+    unsigned int i = index(v);
+    __atomic_store_n(&counts[i], counts[i] + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&total, total + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&sum, sum + v, __ATOMIC_RELAXED);
+  }
+
+  // copy the counts into out; safe from any thread
+  void snapshot(histogram &out) const;
+
+  void clear();
+  void add(const histogram &h);
+  void subtract(const histogram &h);
+
+  uint64_t count() const { return total; }
+
+  // the value at the given percentile (0-100), reported as the
+  // highest value that falls in the same bucket; 0 if empty
+  uint64_t percentile(double p) const;
+
+  // the highest recorded value (to bucket precision); 0 if empty
+  uint64_t max() const;
+
+  // how many recorded values are at most v, counting only the buckets
+  // that lie entirely at or below it
+  uint64_t count_at_most(uint64_t v) const;
+
+  static unsigned int index(uint64_t v);
+  static uint64_t highest_equivalent(unsigned int i);
+
+  uint64_t counts[bucket_count];
+  uint64_t total;
+  uint64_t sum;    // of the values recorded, unclamped
+};
+
+// the phases of a transfer we keep latency histograms for (testclient
+// as it runs, testclient-analyze from a trace); each is the time from
+// the start of the transfer to the end of the phase
+enum { LAT_DNS, LAT_CONNECT, LAT_FIRST_BYTE, LAT_TOTAL, LAT_PHASES };
+extern const char *latency_names[LAT_PHASES];
+
+// p50/p90/p99/p99.9/max of a latency histogram, in milliseconds
+void format_latency(const histogram &h, char *buf, size_t len);
+
+#endif // _HISTOGRAM_HPP
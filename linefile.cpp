@@ -0,0 +1,216 @@
+/*
+  Copyright 2008-2013 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*!
+  \file linefile.cpp
+
+  \brief Mapped line files: implementation details.
+ */
+
+#include "linefile.hpp"
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+line_file::line_file()
+  : map(0), map_len(0)
+{
+}
+
+line_file::~line_file()
+{
+  close();
+}
+
+void line_file::close()
+{
+  if(map)
+    munmap(map, map_len);
+  map = 0;
+  map_len = 0;
+  lines.clear();
+}
+
+namespace {
+
+struct parallel_piece
+{
+  pthread_t thread;
+  size_t begin, end;
+  void (*fn)(size_t, size_t, void *);
+  void *arg;
+};
+
+void * run_piece(void *p)
+{
+  parallel_piece *pp = (parallel_piece *)p;
+  pp->fn(pp->begin, pp->end, pp->arg);
+  return 0;
+}
+
+// indexing is done in two passes over the same byte ranges: count the
+// lines starting in each range, then (with each range's first line
+// number known) fill them in
+struct index_job
+{
+  const char *data;
+  size_t len;
+  std::vector<size_t> chunk_lines; // per chunk: count, then first line number
+  std::vector<line_t> *lines;
+  size_t chunk;
+  bool fill;
+};
+
+// the lines whose first byte is in [begin, end) belong to that range
+void index_range(size_t begin, size_t end, void *arg)
+{
+  index_job *j = (index_job *)arg;
+  const char *s = j->data + begin, *limit = j->data + end, *stop = j->data + j->len;
+  if(begin > 0 && s[-1] != '\n') { // started mid-line; skip to the next one
+    const char *nl = (const char *)memchr(s, '\n', stop - s);
+    s = nl ? nl + 1 : stop;
+  }
+
+  size_t n = 0, at = j->fill ? j->chunk_lines[begin / j->chunk] : 0;
+  while(s < limit) {
+    const char *nl = (const char *)memchr(s, '\n', stop - s);
+    const char *e = nl ? nl : stop;
+    if(e > s) {
+      if(j->fill) {
+        line_t &l = (*j->lines)[at + n];
+        l.p = s;
+        l.len = e - s;
+      }
+      ++n;
+    }
+    s = e + 1;
+  }
+  if(!j->fill)
+    j->chunk_lines[begin / j->chunk] = n;
+}
+
+// the pieces of an index pass are chunk-aligned, and index_range is
+// called once per chunk so each keeps its own count
+void index_chunks(size_t begin, size_t end, void *arg)
+{
+  index_job *j = (index_job *)arg;
+  for(size_t c = begin; c < end; ++c) {
+    size_t b = c * j->chunk, e = b + j->chunk < j->len ? b + j->chunk : j->len;
+    index_range(b, e, arg);
+  }
+}
+
+}
+
+void parallel_for(size_t n, size_t min_per_thread, void (*fn)(size_t, size_t, void *), void *arg)
+{
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t threads = cpus > 1 ? cpus : 1;
+  if(min_per_thread > 0 && n / min_per_thread < threads)
+    threads = n / min_per_thread;
+  if(threads <= 1) {
+    fn(0, n, arg);
+    return;
+  }
+
+  std::vector<parallel_piece> pieces(threads);
+  for(size_t i = 0; i < threads; ++i) {
+    pieces[i].begin = n * i / threads;
+    pieces[i].end = n * (i + 1) / threads;
+    pieces[i].fn = fn;
+    pieces[i].arg = arg;
+  }
+  // the calling thread takes the first piece itself
+  size_t started = 1;
+  for(; started < threads; ++started)
+    if(pthread_create(&pieces[started].thread, 0, run_piece, &pieces[started]) != 0)
+      break;
+  for(size_t i = started; i < threads; ++i) // couldn't start them all
+    run_piece(&pieces[i]);
+  run_piece(&pieces[0]);
+  for(size_t i = 1; i < started; ++i)
+    pthread_join(pieces[i].thread, 0);
+}
+
+bool line_file::load(const char *file)
+{
+  close();
+
+  int fd = open(file, O_RDONLY);
+  if(fd < 0)
+    return false;
+  struct stat st;
+  if(fstat(fd, &st) < 0) {
+    int e = errno;
+    ::close(fd);
+    errno = e;
+    return false;
+  }
+  if(st.st_size == 0) { // nothing to map, and no lines
+    ::close(fd);
+    return true;
+  }
+
+  map_len = st.st_size;
+  void *m = mmap(0, map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+  int e = errno;
+  ::close(fd);
+  if(m == MAP_FAILED) {
+    map_len = 0;
+    errno = e;
+    return false;
+  }
+  map = (char *)m;
+  madvise(map, map_len, MADV_SEQUENTIAL); // for the indexing pass, at least
+
+  // count the lines in each 1MB chunk, then turn the counts into each
+  // chunk's first line number and fill in the index
+  index_job j;
+  j.data = map;
+  j.len = map_len;
+  j.chunk = 1 << 20;
+  size_t chunks = (map_len + j.chunk - 1) / j.chunk;
+  j.chunk_lines.resize(chunks);
+  j.lines = &lines;
+  j.fill = false;
+  parallel_for(chunks, 4, index_chunks, &j);
+
+  size_t total = 0;
+  for(size_t c = 0; c < chunks; ++c) {
+    size_t n = j.chunk_lines[c];
+    j.chunk_lines[c] = total;
+    total += n;
+  }
+  lines.resize(total);
+  j.fill = true;
+  parallel_for(chunks, 4, index_chunks, &j);
+
+  madvise(map, map_len, MADV_NORMAL);
+  return true;
+}
@@ -0,0 +1,86 @@
+/*
+  Copyright 2008-2013 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*!
+  \file linefile.hpp
+
+  \brief Line-oriented input files (URL lists and the like) mapped
+  into memory rather than read.  Loading a file maps it and indexes
+  where each non-empty line starts and how long it is, splitting the
+  scan between threads for big files; the lines themselves are never
+  copied, so a list costs its file size (in page cache) plus 16 bytes
+  a line, however many lines there are.
+
+  A line is a pointer and a length into the mapping, and is not
+  NUL-terminated; print it with "%.*s".  A line can be narrowed in
+  place (to drop a prefix, say) as long as it stays inside the
+  mapping, which lives as long as the line_file.
+ */
+
+#ifndef _LINEFILE_HPP
+#define _LINEFILE_HPP
+
+#include <stddef.h>
+#include <vector>
+
+struct line_t
+{
+  const char *p;
+  unsigned int len;
+};
+
+class line_file
+{
+public:
+  line_file();
+  ~line_file();
+
+  // map the file and index its non-empty lines; returns false (with
+  // errno set) if the file can't be read
+  bool load(const char *file);
+
+  // unmap the file; the lines are no longer valid afterward
+  void close();
+
+  size_t size() const { return lines.size(); }
+  line_t & operator[](size_t i) { return lines[i]; }
+  const line_t & operator[](size_t i) const { return lines[i]; }
+
+  std::vector<line_t> lines;
+
+private:
+  line_file(const line_file &);
+  line_file & operator=(const line_file &);
+
+  char *map;
+  size_t map_len;
+};
+
+// run fn(begin, end, arg) over [0, n) split into contiguous pieces,
+// one per thread, using up to as many threads as there are CPUs (but
+// just the calling thread when n is below min_per_thread)
+void parallel_for(size_t n, size_t min_per_thread, void (*fn)(size_t, size_t, void *), void *arg);
+
+#endif // _LINEFILE_HPP
@@ -0,0 +1,169 @@
+/*
+  Copyright 2008-2013 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*!
+  \file loadprofile.cpp
+
+  \brief Load profiles: implementation details.
+ */
+
+#include "loadprofile.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+load_profile::load_profile()
+  : rate(false)
+{
+}
+
+// "30", "30s", "5m" or "2h"; -1 if it's none of those
+static double parse_length(const char *s)
+{
+  char *end;
+  double v = strtod(s, &end);
+  if(end == s || v <= 0)
+    return -1;
+  if(!strcmp(end, "") || !strcmp(end, "s"))
+    return v;
+  if(!strcmp(end, "m"))
+    return v * 60;
+  if(!strcmp(end, "h"))
+    return v * 3600;
+  return -1;
+}
+
+bool load_profile::load(const char *file, double transactions, double start_rate, const traffic_mix &mix,
+                        std::string &error)
+{
+  FILE *f = fopen(file, "r");
+  if(!f) {
+    error = strerror(errno);
+    return false;
+  }
+
+  // the levels are only known once we've seen which kind the file
+  // uses, so they're kept as given (NAN where a phase doesn't say)
+  // and filled in afterwards
+  std::vector<phase_t> p;
+  bool transactions_seen = false, rate_seen = false;
+  traffic_mix m = mix;
+  char line[1024];
+  int n = 0;
+  while(fgets(line, sizeof(line), f)) {
+    ++n;
+    char *save = 0, *tok = strtok_r(line, " \t\r\n", &save);
+    if(!tok || tok[0] == '#')
+      continue;
+    char where[64];
+    snprintf(where, sizeof(where), "line %d: ", n);
+
+    phase_t ph;
+    ph.name = tok;
+    ph.from = ph.to = NAN;
+    tok = strtok_r(0, " \t\r\n", &save);
+    if(!tok || (ph.secs = parse_length(tok)) < 0) {
+      error = std::string(where) + "phase needs a length, like 30, 30s, 5m or 2h";
+      fclose(f);
+      return false;
+    }
+
+    while((tok = strtok_r(0, " \t\r\n", &save))) {
+      char *eq = strchr(tok, '=');
+      if(!eq) {
+        error = std::string(where) + "expected setting=value, not " + tok;
+        fclose(f);
+        return false;
+      }
+      *eq = 0;
+      std::string key(tok), value(eq + 1);
+      // "a" or "a..b" (split first: strtod would take "1." of "1..8")
+      std::string first(value), second(value);
+      size_t dots = value.find("..");
+      if(dots != value.npos) {
+        first.erase(dots);
+        second.erase(0, dots + 2);
+      }
+      char *end1, *end2;
+      double a = strtod(first.c_str(), &end1), b = strtod(second.c_str(), &end2);
+      bool ok = !first.empty() && !second.empty() && *end1 == 0 && *end2 == 0 && a >= 0 && b >= 0;
+      bool ramp = a != b;
+      if(!ok) {
+        error = std::string(where) + "bad value for " + key + ": " + value;
+        fclose(f);
+        return false;
+      }
+
+      double *prob = key == "br-prob" ? &m.br_prob : key == "throttle-prob" ? &m.throttle_prob :
+        key == "term-prob" ? &m.term_prob : key == "repeat-prob" ? &m.repeat_prob :
+        key == "random-qstring-prob" ? &m.qstring_prob : 0;
+      if(key == "transactions" || key == "rate") {
+        (key == "rate" ? rate_seen : transactions_seen) = true;
+        ph.from = a;
+        ph.to = b;
+      } else if(!prob) {
+        error = std::string(where) + "unknown setting " + key;
+        fclose(f);
+        return false;
+      } else if(ramp || a > 1) {
+        error = std::string(where) + key + " has to be a probability (only levels can ramp)";
+        fclose(f);
+        return false;
+      } else
+        *prob = a;
+    }
+    ph.mix = m;
+    p.push_back(ph);
+  }
+  fclose(f);
+
+  if(p.empty()) {
+    error = "no phases";
+    return false;
+  }
+  if(transactions_seen && rate_seen) {
+    error = "a profile sets transactions or rate, not both";
+    return false;
+  }
+  rate = rate_seen || (!transactions_seen && start_rate > 0);
+  double level = rate ? start_rate : transactions;
+  for(size_t i = 0; i < p.size(); ++i) {
+    if(isnan(p[i].from))
+      p[i].from = p[i].to = level;
+    level = p[i].to;
+  }
+  phases.swap(p);
+  return true;
+}
+
+double load_profile::max_level() const
+{
+  double m = 0;
+  for(size_t i = 0; i < phases.size(); ++i)
+    m = fmax(m, fmax(phases[i].from, phases[i].to));
+  return m;
+}
@@ -0,0 +1,91 @@
+/*
+  Copyright 2008-2013 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*!
+  \file loadprofile.hpp
+
+  \brief A load profile: a list of timed phases, each setting how many
+  transactions to keep going (or how many requests a second to start)
+  and the traffic mix, read from a file like
+
+    # name    length  settings
+    warmup    30s     transactions=1..100
+    steady    5m      transactions=100
+    spike     10s     transactions=400 throttle-prob=0
+    soak      2h      transactions=100 throttle-prob=0.2 br-prob=0.1
+
+  A level written "a..b" ramps linearly from a to b over the phase;
+  one number holds it there.  Lengths are in seconds, or with an s, m
+  or h suffix.  A setting a phase doesn't mention carries over from
+  the phase before (the first phase starts from the command line's).
+  A profile sets either transactions or rate, not both.
+ */
+
+#ifndef _LOADPROFILE_HPP
+#define _LOADPROFILE_HPP
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// the probabilities that decide what each request looks like
+struct traffic_mix
+{
+  double br_prob, throttle_prob, term_prob, repeat_prob, qstring_prob;
+};
+
+class load_profile
+{
+public:
+  struct phase_t {
+    std::string name;
+    double secs;
+    double from, to;     // transactions or rate at the start and the end
+    traffic_mix mix;
+  };
+
+  load_profile();
+
+  // read the phases; transactions, rate and mix are the command line's
+  // settings, for the first phase to start from.  returns false (with
+  // the reason in error) if the file can't be read or parsed.
+  bool load(const char *file, double transactions, double rate, const traffic_mix &mix, std::string &error);
+
+  bool empty() const { return phases.empty(); }
+  size_t size() const { return phases.size(); }
+  const phase_t & operator[](size_t i) const { return phases[i]; }
+
+  // whether the levels are request rates rather than transactions
+  bool by_rate() const { return rate; }
+
+  // the highest level any phase reaches
+  double max_level() const;
+
+private:
+  std::vector<phase_t> phases;
+  bool rate;
+};
+
+#endif // _LOADPROFILE_HPP
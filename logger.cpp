@@ -0,0 +1,248 @@
+/*
+  Copyright 2008-2013 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*!
+  \file logger.cpp
+
+  \brief Background logging: implementation details.
+ */
+
+#include "logger.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+
+int log_level = LOG_INFO;
+bool log_millis = false;
+
+namespace {
+
+// a thread's lines waiting to be written.  head and tail count bytes
+// ever written and read; the logging thread advances head once a
+// whole line is in, and the log thread advances tail once it's out.
+const size_t ring_size = 1 << 20;
+
+struct ring_t
+{
+  char buf[ring_size];
+  uint64_t head __attribute__((aligned(64)));
+  bool busy;                // the thread is between checking running and pushing
+  bool orphaned;            // the thread has exited
+  uint64_t tail __attribute__((aligned(64)));
+  ring_t *next;
+};
+
+ring_t *rings = 0;          // every thread's ring, newest first
+pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+__thread ring_t *my_ring = 0;
+pthread_key_t ring_key;     // to notice when a thread with a ring exits
+
+pthread_t log_thread;
+bool running = false;
+bool stopping = false;
+
+// each thread formats the date and time once a second, and just adds
+// the milliseconds in between
+__thread time_t stamp_sec = -1;
+__thread char stamp[32];
+__thread size_t stamp_len;
+
+size_t format_stamp(char *line)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  if(ts.tv_sec != stamp_sec) {
+    struct tm tm;
+    localtime_r(&ts.tv_sec, &tm);
+    stamp_len = strftime(stamp, sizeof(stamp), "[%m/%d/%Y %H:%M:%S", &tm);
+    stamp_sec = ts.tv_sec;
+  }
+  memcpy(line, stamp, stamp_len);
+  if(log_millis)
+    return stamp_len + sprintf(line + stamp_len, ".%03d] ", int(ts.tv_nsec / 1000000));
+  memcpy(line + stamp_len, "] ", 2);
+  return stamp_len + 2;
+}
+
+// a thread's ring outlives it until log_stop(), which writes out the
+// rest and frees it
+void orphan(void *r)
+{
+  __atomic_store_n(&((ring_t *)r)->orphaned, true, __ATOMIC_RELEASE);
+}
+
+ring_t * get_ring()
+{
+  if(!my_ring) {
+    my_ring = new ring_t;
+    my_ring->head = my_ring->tail = 0;
+    my_ring->busy = my_ring->orphaned = false;
+    pthread_setspecific(ring_key, my_ring);
+    pthread_mutex_lock(&rings_lock);
+    my_ring->next = rings;
+    __atomic_store_n(&rings, my_ring, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&rings_lock);
+  }
+  return my_ring;
+}
+
+// copy a line into this thread's ring; if the log thread has fallen
+// a whole ring behind, wait for it rather than lose lines
+void push(const char *line, size_t n)
+{
+  ring_t *r = get_ring();
+  uint64_t head = r->head;
+  while(ring_size - (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE)) < n)
+    sched_yield();
+  size_t off = head % ring_size, first = n < ring_size - off ? n : ring_size - off;
+  memcpy(r->buf + off, line, first);
+  memcpy(r->buf, line + first, n - first);
+  __atomic_store_n(&r->head, head + n, __ATOMIC_RELEASE);
+}
+
+// write out everything in the rings; returns false if there was nothing
+bool drain()
+{
+  bool any = false;
+  for(ring_t *r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r; r = r->next) {
+    uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE), tail = r->tail;
+    if(head == tail)
+      continue;
+    size_t n = head - tail, off = tail % ring_size, first = n < ring_size - off ? n : ring_size - off;
+    fwrite(r->buf + off, 1, first, stdout);
+    fwrite(r->buf, 1, n - first, stdout);
+    __atomic_store_n(&r->tail, head, __ATOMIC_RELEASE);
+    any = true;
+  }
+  if(any)
+    fflush(stdout);
+  return any;
+}
+
+void * run_log_thread(void *)
+{
+  while(!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE))
+    if(!drain())
+      usleep(10000);
+  drain();
+  return 0;
+}
+
+} // namespace
+
+void mylog(int level, const char *fmt, ...)
+{
+  if(!log_enabled(level))
+    return;
+  char line[2048];
+  size_t n = format_stamp(line);
+  va_list args;
+  va_start(args, fmt);
+  int m = vsnprintf(line + n, sizeof(line) - n - 1, fmt, args);
+  va_end(args);
+  if(m < 0)
+    m = 0;
+  n += m < int(sizeof(line) - n - 1) ? m : sizeof(line) - n - 2;
+  line[n++] = '\n';
+  if(__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+    // busy tells log_stop() to wait for this line before the last
+    // drain; running is checked again after setting it (both seq_cst),
+    // so either log_stop() sees busy or we see it's stopped
+    ring_t *r = get_ring();
+    __atomic_store_n(&r->busy, true, __ATOMIC_SEQ_CST);
+    bool pushed = __atomic_load_n(&running, __ATOMIC_SEQ_CST);
+    if(pushed)
+      push(line, n);
+    __atomic_store_n(&r->busy, false, __ATOMIC_RELEASE);
+    if(pushed)
+      return;
+  }
+  fwrite(line, 1, n, stdout);
+}
+
+void log_start()
+{
+  static bool registered = false;
+  if(running)
+    return;
+  fflush(stdout);
+  if(!registered)
+    pthread_key_create(&ring_key, orphan);
+  stopping = false;
+  if(pthread_create(&log_thread, 0, run_log_thread, 0) != 0) {
+    mylog(LOG_ERROR, "error: starting log thread");
+    exit(1);
+  }
+  __atomic_store_n(&running, true, __ATOMIC_RELEASE);
+  if(!registered) {
+    atexit(log_stop);
+    registered = true;
+  }
+}
+
+// new lines go straight out from here on; once the lines already on
+// their way into a ring are in, the log thread writes what's in the
+// rings and finishes.  then the rings of threads that have exited, and
+// our own, are freed; a thread that's still running may yet touch its
+// ring, so that one is kept (this only happens when exit() is called
+// from some other thread while the workers run).
+void log_stop()
+{
+  if(!__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+    return;
+  __atomic_store_n(&running, false, __ATOMIC_SEQ_CST);
+  // (holding the lock, so a ring being added now is either seen here
+  // or added by a thread that will see running is false)
+  pthread_mutex_lock(&rings_lock);
+  for(ring_t *r = rings; r; r = r->next)
+    while(__atomic_load_n(&r->busy, __ATOMIC_SEQ_CST))
+      sched_yield();
+  pthread_mutex_unlock(&rings_lock);
+  __atomic_store_n(&stopping, true, __ATOMIC_RELEASE);
+  pthread_join(log_thread, 0);
+  fflush(stdout);
+
+  pthread_mutex_lock(&rings_lock);
+  ring_t **link = &rings;
+  while(*link) {
+    ring_t *r = *link;
+    if(r == my_ring || __atomic_load_n(&r->orphaned, __ATOMIC_ACQUIRE)) {
+      *link = r->next;
+      delete r;
+    } else
+      link = &r->next;
+  }
+  pthread_mutex_unlock(&rings_lock);
+  if(my_ring) {
+    pthread_setspecific(ring_key, 0);
+    my_ring = 0;
+  }
+}
@@ -0,0 +1,71 @@
+/*
+  Copyright 2008-2013 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*!
+  \file logger.hpp
+
+  \brief Timestamped log lines, written out by a background thread.
+  Each thread formats its lines into its own ring buffer, which only
+  it writes and only the log thread reads, so logging takes no locks
+  and makes no system calls; the log thread collects whatever is in
+  the rings every few milliseconds and writes it out in big batches.
+  Lines from one thread come out in order, and whole; lines from
+  different threads may come out in a different order than they were
+  logged, a few milliseconds apart at most.
+
+  Lines below the current level are dropped before they're formatted;
+  the level can be changed at any time, from any thread (or a signal
+  handler).  Until log_start() is called, and after log_stop(), lines
+  are written straight to stdout.
+ */
+
+#ifndef _LOGGER_HPP
+#define _LOGGER_HPP
+
+enum { LOG_ERROR, LOG_WARNING, LOG_STATUS, LOG_INFO };
+
+extern int log_level;    // the most verbose level that gets logged
+extern bool log_millis;  // put milliseconds in the timestamps
+
+inline bool log_enabled(int level)
+{
+  return level <= __atomic_load_n(&log_level, __ATOMIC_RELAXED);
+}
+
+inline void log_set_level(int level)
+{
+  __atomic_store_n(&log_level, level, __ATOMIC_RELAXED);
+}
+
+// print timestamp, then log line, then newline
+void mylog(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// start the log thread; log_stop() (also run at exit) waits for any
+// lines other threads are in the middle of logging, writes out what's
+// left, stops it, and frees the rings of the threads that have exited
+void log_start();
+void log_stop();
+
+#endif // _LOGGER_HPP
@@ -0,0 +1,213 @@
+/*
+  Copyright 2008-2013 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*!
+  \file metrics.cpp
+
+  \brief Metrics page server: implementation details.
+ */
+
+#include "metrics.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+namespace {
+
+const size_t max_conns = 64;
+const size_t max_request = 8192;
+const uint64_t conn_timeout = 10000000000ULL; // drop a connection after 10s
+
+uint64_t now_nsec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return uint64_t(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+}
+
+metrics_server::metrics_server()
+{
+  listen_fd = -1;
+}
+
+metrics_server::~metrics_server()
+{
+  for(unsigned int i = 0; i < conns.size(); ++i)
+    close(conns[i].fd);
+  if(listen_fd >= 0)
+    close(listen_fd);
+}
+
+bool metrics_server::start(int port, std::string &error)
+{
+  listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if(listen_fd < 0) {
+    error = strerror(errno);
+    return false;
+  }
+  int one = 1;
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl(INADDR_ANY);
+  sa.sin_port = htons(port);
+  if(bind(listen_fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 || listen(listen_fd, 16) < 0) {
+    error = strerror(errno);
+    close(listen_fd);
+    listen_fd = -1;
+    return false;
+  }
+  return true;
+}
+
+void metrics_server::accept_all()
+{
+  for(;;) {
+    int fd = accept4(listen_fd, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if(fd < 0)
+      return;
+    if(conns.size() >= max_conns) {
+      close(fd);
+      continue;
+    }
+    conn_t c;
+    c.fd = fd;
+    c.sent = 0;
+    c.opened = now_nsec();
+    conns.push_back(c);
+  }
+}
+
+// read what's there; once the headers are all in, queue the
+// response.  returns false if the connection should be dropped.
+bool metrics_server::read_request(conn_t &c, void (*render)(std::string &))
+{
+  char buf[4096];
+  bool eof = false;
+  for(;;) {
+    ssize_t n = read(c.fd, buf, sizeof(buf));
+    if(n == 0) { // a scraper may half-close once it's sent the request
+      eof = true;
+      break;
+    }
+    if(n < 0) {
+      if(errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      return false;
+    }
+    c.in.append(buf, n);
+    if(c.in.size() > max_request)
+      return false;
+  }
+  if(c.in.find("\r\n\r\n") == std::string::npos && c.in.find("\n\n") == std::string::npos)
+    return !eof; // the rest is yet to come, unless it never will
+
+  std::string body;
+  const char *status = "200 OK";
+  if(!c.in.compare(0, 13, "GET /metrics ") || !c.in.compare(0, 13, "GET /metrics?"))
+    render(body);
+  else {
+    status = "404 Not Found";
+    body = "try /metrics\n";
+  }
+  char head[256];
+  snprintf(head, sizeof(head), "HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4\r\n"
+           "Content-Length: %lu\r\nConnection: close\r\n\r\n", status, (unsigned long)body.size());
+  c.out = head + body;
+  c.in.clear();
+  return write_response(c);
+}
+
+// send what we can; returns false once it's all gone (or can't go)
+bool metrics_server::write_response(conn_t &c)
+{
+  while(c.sent < c.out.size()) {
+    ssize_t n = send(c.fd, c.out.data() + c.sent, c.out.size() - c.sent, MSG_NOSIGNAL);
+    if(n < 0)
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    c.sent += n;
+  }
+  return false;
+}
+
+void metrics_server::serve_until(uint64_t deadline, void (*render)(std::string &), volatile sig_atomic_t *stop)
+{
+  std::vector<struct pollfd> fds;
+  for(;;) {
+    uint64_t now = now_nsec();
+    if(now >= deadline)
+      return;
+
+    fds.clear();
+    struct pollfd l = { listen_fd, POLLIN, 0 };
+    fds.push_back(l);
+    for(unsigned int i = 0; i < conns.size(); ++i) {
+      struct pollfd p = { conns[i].fd, short(conns[i].out.empty() ? POLLIN : POLLOUT), 0 };
+      fds.push_back(p);
+    }
+    int n = poll(&fds[0], fds.size(), int((deadline - now + 999999) / 1000000));
+    if(n < 0) {
+      if(errno == EINTR && !*stop)
+        continue; // e.g. a log level change; the deadline still stands
+      return;
+    }
+
+    // serve the connections with something to do, dropping the ones
+    // that are finished, broken or too slow
+    now = now_nsec();
+    unsigned int keep = 0;
+    for(unsigned int i = 0; i < conns.size(); ++i) {
+      conn_t &c = conns[i];
+      bool open = true;
+      short ev = fds[i + 1].revents;
+      if(ev & POLLIN)
+        open = read_request(c, render);
+      else if(ev & POLLOUT)
+        open = write_response(c);
+      else if(ev & (POLLERR | POLLHUP | POLLNVAL))
+        open = false;
+      if(open && now - c.opened > conn_timeout)
+        open = false;
+      if(open)
+        conns[keep++] = c;
+      else
+        close(c.fd);
+    }
+    conns.resize(keep);
+
+    if(fds[0].revents & POLLIN)
+      accept_all();
+  }
+}
@@ -0,0 +1,76 @@
+/*
+  Copyright 2008-2013 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*!
+  \file metrics.hpp
+
+  \brief A very small HTTP server for a metrics page (Prometheus text
+  format), run from the caller's own loop: instead of sleeping until
+  its next deadline, the loop calls serve_until(), which polls the
+  listening socket and any open connections and answers scrapes in
+  between.  Sockets are non-blocking, so a slow scraper can't hold the
+  loop up; the page is only rendered when a request for it has
+  arrived, and every connection is closed after one response.
+ */
+
+#ifndef _METRICS_HPP
+#define _METRICS_HPP
+
+#include <stdint.h>
+#include <signal.h>
+#include <string>
+#include <vector>
+
+class metrics_server
+{
+public:
+  metrics_server();
+  ~metrics_server();
+
+  // listen on the port; on failure returns false and says why
+  bool start(int port, std::string &error);
+
+  // answer requests until the deadline (on the monotonic clock, in
+  // ns), or until a signal handler sets stop (other signals don't cut
+  // the wait short); GET /metrics calls render for the page
+  void serve_until(uint64_t deadline, void (*render)(std::string &page), volatile sig_atomic_t *stop);
+
+private:
+  struct conn_t {
+    int fd;
+    std::string in, out;
+    size_t sent;
+    uint64_t opened;
+  };
+
+  void accept_all();
+  bool read_request(conn_t &c, void (*render)(std::string &));
+  bool write_response(conn_t &c);
+
+  int listen_fd;
+  std::vector<conn_t> conns;
+};
+
+#endif // _METRICS_HPP
@@ -0,0 +1,88 @@
+/*
+  Copyright 2008-2013 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*!
+  \file synthetic.cpp
+
+  \brief Synthetic objects: implementation details.
+ */
+
+#include "synthetic.hpp"
+#include <string.h>
+#include <endian.h>
+
+uint64_t synthetic_key(uint64_t corpus_key, const char *path, size_t len)
+{
+  // FNV-1a, then one more mixing round so similar paths get
+  // unrelated streams
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for(size_t i = 0; i < len; ++i) {
+    h ^= (unsigned char)path[i];
+    h *= 0x100000001b3ULL;
+  }
+  return synthetic_word(h, corpus_key);
+}
+
+void synthetic_fill(uint64_t key, uint64_t off, unsigned char *buf, size_t n)
+{
+  uint64_t word = off / 8;
+  unsigned int skip = off % 8;
+  while(n > 0) {
+    uint64_t w = htole64(synthetic_word(key, word++));
+    size_t take = 8 - skip < n ? 8 - skip : n;
+    memcpy(buf, (const unsigned char *)&w + skip, take);
+    buf += take;
+    n -= take;
+    skip = 0;
+  }
+}
+
+size_t synthetic_check(uint64_t key, uint64_t off, const unsigned char *data, size_t n)
+{
+  size_t done = 0;
+  uint64_t word = off / 8;
+  unsigned int skip = off % 8;
+
+  // whole words at a time once we're aligned with the stream; on a
+  // mismatch, fall through to the bytewise loop to find the byte
+  if(skip == 0) {
+    for(; n - done >= 8; done += 8, ++word) {
+      uint64_t d;
+      memcpy(&d, data + done, 8);
+      if(d != htole64(synthetic_word(key, word)))
+        break;
+    }
+  }
+
+  while(done < n) {
+    uint64_t w = htole64(synthetic_word(key, word++));
+    const unsigned char *e = (const unsigned char *)&w;
+    for(unsigned int i = skip; i < 8 && done < n; ++i, ++done)
+      if(data[done] != e[i])
+        return done;
+    skip = 0;
+  }
+  return done;
+}
@@ -0,0 +1,63 @@
+/*
+  Copyright 2008-2013 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*!
+  \file synthetic.hpp
+
+  \brief Synthetic objects whose content is a pure function of a key
+  and the object's path, so any byte range of any object can be
+  checked without keeping a copy of it anywhere.  Byte o of an object
+  is byte (o % 8) of word o / 8 of a stream made by running
+  splitmix64 over (path hash + word index), in little-endian order on
+  every machine.  Generating or checking costs a multiply-xorshift
+  round per 8 bytes, which is about memory bandwidth.
+ */
+
+#ifndef _SYNTHETIC_HPP
+#define _SYNTHETIC_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+// the key of the object at the given path (starting at its first
+// '/', without any query string) under the given corpus key
+uint64_t synthetic_key(uint64_t corpus_key, const char *path, size_t len);
+
+inline uint64_t synthetic_word(uint64_t key, uint64_t index)
+{
+  uint64_t z = key + (index + 1) * 0x9e3779b97f4a7c15ULL;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+// the object's bytes [off, off + n)
+void synthetic_fill(uint64_t key, uint64_t off, unsigned char *buf, size_t n);
+
+// compare data with the object's bytes [off, off + n); returns how
+// many bytes matched before the first difference (n if they all did)
+size_t synthetic_check(uint64_t key, uint64_t off, const unsigned char *data, size_t n);
+
+#endif // _SYNTHETIC_HPP
@@ -0,0 +1,342 @@
+/*
+  Copyright 2008-2013 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+// summarize a trace written by testclient --trace: overall counts and
+// latency, then per server, per URL (the most requested ones) and
+// per interval of the run; see trace.hpp for the format
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <algorithm>
+#include <functional>
+#include <vector>
+#include <string>
+#include <map>
+#include <iostream>
+#include <curl/curl.h>
+#include "options.hpp"
+#include "histogram.hpp"
+#include "linefile.hpp"
+#include "workload.hpp"
+#include "trace.hpp"
+
+const char *result_names[TRACE_RESULTS] = {
+  "unchecked", "ok", "transfer errors", "content errors", "size errors", "md5 errors"
+};
+
+trace_file trace;
+line_file url;                  // to name the URLs, if given the list
+workload compiled;              // ... or the compiled workload
+std::vector<std::string> servers;
+
+// counts for some subset of the records
+struct summary
+{
+  summary() : requests(0), errors(0), bytes(0) {}
+  void add(const trace_record &r);
+
+  uint64_t requests, errors, bytes;
+  histogram latency[LAT_PHASES]; // of completed transfers, as testclient counts them
+};
+
+inline bool is_error(const trace_record &r)
+{
+  return r.result >= TRACE_TRANSFER_ERROR;
+}
+
+void summary::add(const trace_record &r)
+{
+  ++requests;
+  bytes += r.bytes;
+  if(is_error(r))
+    ++errors;
+  if(r.curl_result == 0 && !(r.flags & TRACE_TERMINATED)) {
+    latency[LAT_DNS].record(uint64_t(r.dns) + r.behind);
+    latency[LAT_CONNECT].record(uint64_t(r.connect) + r.behind);
+    latency[LAT_FIRST_BYTE].record(uint64_t(r.first_byte) + r.behind);
+    latency[LAT_TOTAL].record(uint64_t(r.total) + r.behind);
+  }
+}
+
+void print_latency(const char *indent, const histogram *h)
+{
+  if(h[LAT_TOTAL].count() == 0)
+    return;
+  char buf[LAT_PHASES][128];
+  for(int p = 0; p < LAT_PHASES; ++p)
+    format_latency(h[p], buf[p], sizeof(buf[p]));
+  printf("%slatency: %s %s, %s %s, %s %s, %s %s (p50/p90/p99/p99.9/max ms, %lu transfers)\n", indent,
+         latency_names[LAT_DNS], buf[LAT_DNS], latency_names[LAT_CONNECT], buf[LAT_CONNECT],
+         latency_names[LAT_FIRST_BYTE], buf[LAT_FIRST_BYTE], latency_names[LAT_TOTAL], buf[LAT_TOTAL],
+         (unsigned long)h[LAT_TOTAL].count());
+}
+
+std::string url_name(uint32_t i)
+{
+  char buf[64];
+  if(compiled.size() && i < compiled.size()) {
+    line_t host = compiled.host(i), path = compiled.path(i);
+    std::string s(host.len ? "http://" : "");
+    return s + std::string(host.p, host.len) + std::string(path.p, path.len);
+  }
+  if(i < url.size())
+    return std::string(url[i].p, url[i].len);
+  snprintf(buf, sizeof(buf), "URL %u", i);
+  return buf;
+}
+
+std::string server_name(int32_t i)
+{
+  char buf[64];
+  if(i >= 0 && (size_t)i < servers.size())
+    return servers[i];
+  snprintf(buf, sizeof(buf), "server %d", i);
+  return buf;
+}
+
+// the p'th percentile of a sorted list, the same way histogram does it
+uint32_t percentile(const std::vector<uint32_t> &v, double p)
+{
+  if(v.empty())
+    return 0;
+  size_t rank = (size_t)ceil(p / 100.0 * v.size());
+  return v[rank < 1 ? 0 : rank - 1];
+}
+
+int main(int argc, char **argv)
+{
+  options::add<bool>("help", "h", "Print usage information", "", false);
+  options::add<std::string>("url-list", "u", "URL list (or compiled workload) the run used, to name the URLs",
+                            "Input", "");
+  options::add<std::string>("server-list", 0, "Server list the run used, to name the servers", "Input", "");
+  options::add<int>("top", "t", "How many of the most requested URLs to break down", "Output", 10);
+  options::add<double>("interval", "i", "Seconds per line of the time series, at least 0.001 (0 for none)", "Output", 1.0);
+
+  int inpidx = options::parse_cmdline(argc, argv);
+  if(inpidx < 0)
+    return 1;
+  if(inpidx + 1 > argc || options::quickget<bool>("help")) {
+    std::cerr << "Usage: " << argv[0] << " [options] trace-file" << std::endl;
+    options::print_options(std::cout);
+    return 1;
+  }
+  const char *trace_file_name = argv[inpidx];
+  std::string url_file = options::quickget<std::string>("url-list");
+  std::string server_file = options::quickget<std::string>("server-list");
+  int top = options::quickget<int>("top");
+  double interval = options::quickget<double>("interval");
+  if(interval > 0 && interval < 0.001) { // a step of 0 ns can't bucket anything
+    std::cerr << "The interval must be at least 0.001 seconds (or 0 for no time series)" << std::endl;
+    return 1;
+  }
+
+  std::string error;
+  if(!trace.load(trace_file_name, error)) {
+    fprintf(stderr, "%s: %s\n", trace_file_name, error.c_str());
+    return 1;
+  }
+  if(url_file.length()) {
+    if(workload::is_workload(url_file.c_str())) {
+      if(!compiled.load(url_file.c_str(), error)) {
+        fprintf(stderr, "%s: %s\n", url_file.c_str(), error.c_str());
+        return 1;
+      }
+    } else if(!url.load(url_file.c_str())) {
+      fprintf(stderr, "%s: can't read it\n", url_file.c_str());
+      return 1;
+    }
+  }
+  if(server_file.length()) {
+    FILE *f = fopen(server_file.c_str(), "r");
+    if(!f) {
+      fprintf(stderr, "%s: can't read it\n", server_file.c_str());
+      return 1;
+    }
+    char line[1024], name[1024];
+    while(fgets(line, sizeof(line), f))
+      if(sscanf(line, "%1023s", name) == 1)
+        servers.push_back(name);
+    fclose(f);
+  }
+
+  // the first pass adds everything up overall and per server, counts
+  // requests per URL, and finds out how long the run was
+  const trace_header &h = trace.header();
+  uint64_t n = trace.size(), unfinished = 0, end = 0, begin = ~0ULL;
+  summary all, hits, misses;
+  std::map<int32_t, summary> per_server;
+  std::map<uint32_t, uint64_t> url_requests;
+  uint64_t results[TRACE_RESULTS] = { 0 }, terminated = 0, throttled = 0, ranges = 0, whole = 0, late = 0;
+  std::map<unsigned int, uint64_t> statuses, curl_errors;
+  trace_record r;
+  for(uint64_t i = 0; i < n; ++i) {
+    if(!trace.get(i, r)) {
+      ++unfinished;
+      continue;
+    }
+    all.add(r);
+    if(r.server >= 0)
+      per_server[r.server].add(r);
+    ++url_requests[r.url_id];
+    if(r.result < TRACE_RESULTS)
+      ++results[r.result];
+    terminated += (r.flags & TRACE_TERMINATED) != 0;
+    throttled += (r.flags & TRACE_THROTTLED) != 0;
+    ranges += (r.flags & TRACE_RANGE) != 0;
+    whole += (r.flags & TRACE_WHOLE_FILE) != 0;
+    late += (r.flags & TRACE_LATE) != 0;
+    if(r.flags & TRACE_CACHE_HIT)
+      hits.add(r);
+    if(r.flags & TRACE_CACHE_MISS)
+      misses.add(r);
+    if(r.status)
+      ++statuses[r.status];
+    if(r.curl_result)
+      ++curl_errors[r.curl_result];
+    if(r.start < begin)
+      begin = r.start;
+    if(r.start + uint64_t(r.total) * 1000 > end)
+      end = r.start + uint64_t(r.total) * 1000;
+  }
+  if(all.requests == 0) {
+    printf("no finished requests in %s\n", trace_file_name);
+    return 0;
+  }
+
+  double secs = (end - begin) / 1e9;
+  time_t wall = (h.start_time + begin) / 1000000000LL;
+  char date[64];
+  strftime(date, sizeof(date), "%m/%d/%Y %H:%M:%S", localtime(&wall));
+  printf("%lu requests over %.1f seconds from %s", (unsigned long)all.requests, secs, date);
+  if(h.count > n)
+    printf(" (the %lu before them were overwritten)", (unsigned long)(h.count - n));
+  if(unfinished)
+    printf(" (%lu unfinished)", (unsigned long)unfinished);
+  printf("\n");
+  printf("~%.0f req per sec, %lu bytes, ~%.0f Bps download\n", secs > 0 ? all.requests / secs : 0.0,
+         (unsigned long)all.bytes, secs > 0 ? all.bytes / secs : 0.0);
+
+  printf("results:");
+  for(int i = 0; i < TRACE_RESULTS; ++i)
+    printf("%s %lu %s", i ? "," : "", (unsigned long)results[i], result_names[i]);
+  printf("\n");
+  printf("%lu terminated early, %lu throttled, %lu byte ranges (%lu got the whole file), %lu started late\n",
+         (unsigned long)terminated, (unsigned long)throttled, (unsigned long)ranges,
+         (unsigned long)whole, (unsigned long)late);
+  if(!statuses.empty()) {
+    printf("HTTP status:");
+    for(std::map<unsigned int, uint64_t>::iterator it = statuses.begin(); it != statuses.end(); ++it)
+      printf("%s %u: %lu", it == statuses.begin() ? "" : ",", it->first, (unsigned long)it->second);
+    printf("\n");
+  }
+  for(std::map<unsigned int, uint64_t>::iterator it = curl_errors.begin(); it != curl_errors.end(); ++it)
+    printf("curl error %u (%s): %lu\n", it->first, curl_easy_strerror(CURLcode(it->first)),
+           (unsigned long)it->second);
+  print_latency("", all.latency);
+  if(hits.requests + misses.requests) {
+    // recorded with --cache-stats
+    printf("cache: %lu hits, %lu misses, %.1f%% hit ratio, %.1f%% byte hit ratio\n",
+           (unsigned long)hits.requests, (unsigned long)misses.requests,
+           100.0 * hits.requests / (hits.requests + misses.requests),
+           hits.bytes + misses.bytes ? 100.0 * hits.bytes / (hits.bytes + misses.bytes) : 0.0);
+    print_latency("hit ", hits.latency);
+    print_latency("miss ", misses.latency);
+  }
+
+  for(std::map<int32_t, summary>::iterator it = per_server.begin(); it != per_server.end(); ++it) {
+    summary &s = it->second;
+    printf("\n%s: %lu requests (%.1f%%), %lu errors, %lu bytes, ~%.0f Bps download\n",
+           server_name(it->first).c_str(), (unsigned long)s.requests, 100.0 * s.requests / all.requests,
+           (unsigned long)s.errors, (unsigned long)s.bytes, secs > 0 ? s.bytes / secs : 0.0);
+    print_latency("  ", s.latency);
+  }
+
+  // the most requested URLs get a second pass of their own
+  if(top > 0) {
+    std::vector<std::pair<uint64_t, uint32_t> > by_count;
+    for(std::map<uint32_t, uint64_t>::iterator it = url_requests.begin(); it != url_requests.end(); ++it)
+      by_count.push_back(std::make_pair(it->second, it->first));
+    size_t shown = std::min(by_count.size(), (size_t)top);
+    std::partial_sort(by_count.begin(), by_count.begin() + shown, by_count.end(),
+                      std::greater<std::pair<uint64_t, uint32_t> >());
+    std::map<uint32_t, summary> per_url;
+    for(size_t i = 0; i < shown; ++i)
+      per_url[by_count[i].second];
+    for(uint64_t i = 0; i < n; ++i) {
+      if(!trace.get(i, r))
+        continue;
+      std::map<uint32_t, summary>::iterator it = per_url.find(r.url_id);
+      if(it != per_url.end())
+        it->second.add(r);
+    }
+    printf("\nthe %lu most requested of %lu URLs:\n", (unsigned long)shown, (unsigned long)by_count.size());
+    for(size_t i = 0; i < shown; ++i) {
+      summary &s = per_url[by_count[i].second];
+      printf("%s: %lu requests, %lu errors, %lu bytes\n", url_name(by_count[i].second).c_str(),
+             (unsigned long)s.requests, (unsigned long)s.errors, (unsigned long)s.bytes);
+      print_latency("  ", s.latency);
+    }
+  }
+
+  // and the time series, by when the requests started, with exact
+  // percentiles of the total time
+  if(interval > 0) {
+    uint64_t step = uint64_t(interval * 1e9);
+    size_t slots = (end - begin) / step + 1;
+    std::vector<uint64_t> requests(slots), bytes(slots), errors(slots), hit(slots), miss(slots);
+    std::vector<std::vector<uint32_t> > totals(slots);
+    for(uint64_t i = 0; i < n; ++i) {
+      if(!trace.get(i, r))
+        continue;
+      size_t j = (r.start - begin) / step;
+      ++requests[j];
+      bytes[j] += r.bytes;
+      errors[j] += is_error(r);
+      hit[j] += (r.flags & TRACE_CACHE_HIT) != 0;
+      miss[j] += (r.flags & TRACE_CACHE_MISS) != 0;
+      if(r.curl_result == 0 && !(r.flags & TRACE_TERMINATED))
+        totals[j].push_back(r.total + r.behind);
+    }
+    // with a hit ratio column, if the run classified cache hits
+    bool cache = hits.requests + misses.requests > 0;
+    printf("\n%10s %12s %14s %8s %10s %10s %10s%s\n", "seconds", "req per sec", "Bps", "errors",
+           "p50 ms", "p99 ms", "max ms", cache ? "      hit %" : "");
+    for(size_t j = 0; j < slots; ++j) {
+      std::sort(totals[j].begin(), totals[j].end());
+      printf("%10.1f %12.0f %14.0f %8lu %10.3f %10.3f %10.3f", j * interval,
+             requests[j] / interval, bytes[j] / interval, (unsigned long)errors[j],
+             percentile(totals[j], 50.0) / 1000.0, percentile(totals[j], 99.0) / 1000.0,
+             totals[j].empty() ? 0.0 : totals[j].back() / 1000.0);
+      if(cache)
+        printf(" %10.1f", hit[j] + miss[j] ? 100.0 * hit[j] / (hit[j] + miss[j]) : 0.0);
+      printf("\n");
+    }
+  }
+
+  return 0;
+}
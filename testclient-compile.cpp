@@ -0,0 +1,279 @@
+/*
+  Copyright 2008-2013 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+// turn a URL list (and optionally its md5, local file and weight
+// lists) into a compiled workload file for testclient; see
+// workload.hpp for the format
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <map>
+#include <vector>
+#include <string>
+#include <iostream>
+#include "options.hpp"
+#include "linefile.hpp"
+#include "workload.hpp"
+
+line_file url, md5, local, size_list;
+std::vector<workload_url> urls;
+std::vector<workload_ref> hosts, locals;
+std::vector<unsigned char> digests;
+std::vector<uint64_t> sizes;
+std::vector<double> weights;
+std::vector<char> strings;
+
+void die(const char *what, const char *file)
+{
+  fprintf(stderr, "%s: %s\n", file, what);
+  exit(1);
+}
+
+void need_same_size(const line_file &f, const char *file)
+{
+  if(f.size() != url.size())
+    die("must be the same size as the URL list", file);
+}
+
+uint64_t add_string(const char *p, size_t len)
+{
+  uint64_t off = strings.size();
+  strings.insert(strings.end(), p, p + len);
+  return off;
+}
+
+// parsing md5s and finding object sizes are done a piece at a time
+// (see parallel_for); bad is 1 + the index of a line that failed
+struct check_job
+{
+  size_t bad;
+  int err;
+};
+
+void parse_md5s(size_t begin, size_t end, void *arg)
+{
+  check_job *j = (check_job *)arg;
+  for(size_t i = begin; i < end; ++i)
+    if(!parse_md5(md5[i], &digests[16 * i]))
+      __atomic_store_n(&j->bad, i + 1, __ATOMIC_RELAXED);
+}
+
+void stat_locals(size_t begin, size_t end, void *arg)
+{
+  check_job *j = (check_job *)arg;
+  char name[PATH_MAX];
+  struct stat st;
+  for(size_t i = begin; i < end; ++i) {
+    unsigned int n = local[i].len < PATH_MAX ? local[i].len : PATH_MAX - 1;
+    memcpy(name, local[i].p, n);
+    name[n] = 0;
+    if(stat(name, &st) < 0) {
+      __atomic_store_n(&j->err, errno, __ATOMIC_RELAXED);
+      __atomic_store_n(&j->bad, i + 1, __ATOMIC_RELAXED);
+    } else
+      sizes[i] = st.st_size;
+  }
+}
+
+// write a vector as a section at the next 8-byte boundary; returns
+// its offset (write errors are caught by ferror at the end)
+template <class T>
+uint64_t write_section(FILE *f, const std::vector<T> &v)
+{
+  static const char zeros[8] = { 0 };
+  long pos = ftell(f);
+  if(pos % 8)
+    fwrite(zeros, 1, 8 - pos % 8, f);
+  pos = ftell(f);
+  if(!v.empty())
+    fwrite(&v[0], sizeof(T), v.size(), f);
+  return pos;
+}
+
+int main(int argc, char **argv)
+{
+  options::add<bool>("help", "h", "Print usage information", "", false);
+  options::add<std::string>("md5-list", "m", "File with MD5 sums for each URL", "Input", "");
+  options::add<std::string>("local-list", "l", "File with local filenames for each URL (their sizes are recorded too)",
+                            "Input", "");
+  options::add<std::string>("size-list", 0, "File with the size of each URL's object, if there's no local list",
+                            "Input", "");
+  options::add<std::string>("url-weights", 0, "File with a popularity weight for each URL", "Input", "");
+
+  int inpidx = options::parse_cmdline(argc, argv);
+  if(inpidx < 0)
+    return 1;
+  if(inpidx + 2 > argc || options::quickget<bool>("help")) {
+    std::cerr << "Usage: " << argv[0] << " [options] url-file workload-file" << std::endl;
+    options::print_options(std::cout);
+    return 1;
+  }
+  const char *url_file = argv[inpidx], *out_file = argv[inpidx + 1];
+  std::string md5_file = options::quickget<std::string>("md5-list");
+  std::string local_file = options::quickget<std::string>("local-list");
+  std::string weights_file = options::quickget<std::string>("url-weights");
+  std::string size_file = options::quickget<std::string>("size-list");
+  if(size_file.length() && local_file.length()) {
+    fprintf(stderr, "Sizes come from the local files; no need for a size list too\n");
+    return 1;
+  }
+
+  if(!url.load(url_file))
+    die(strerror(errno), url_file);
+
+  // split each URL into an (interned) host and a path
+  std::map<std::string, uint32_t> host_ids;
+  uint32_t longest_host = 0, longest_path = 0;
+  urls.resize(url.size());
+  for(size_t i = 0; i < url.size(); ++i) {
+    const line_t &u = url[i];
+    workload_url &wu = urls[i];
+    if(u.len > 7 && !strncmp(u.p, "http://", 7)) {
+      const char *sl = (const char *)memchr(u.p + 7, '/', u.len - 7);
+      size_t host_len = sl ? sl - u.p - 7 : u.len - 7;
+      std::string host(u.p + 7, host_len);
+      std::map<std::string, uint32_t>::iterator it = host_ids.find(host);
+      if(it == host_ids.end()) {
+        workload_ref r;
+        r.off = add_string(host.data(), host.size());
+        r.len = host.size();
+        r.pad = 0;
+        it = host_ids.insert(std::make_pair(host, (uint32_t)hosts.size())).first;
+        hosts.push_back(r);
+      }
+      wu.host = it->second;
+      wu.path_off = add_string(u.p + 7 + host_len, u.len - 7 - host_len);
+      wu.path_len = u.len - 7 - host_len;
+      if(host_len > longest_host)
+        longest_host = host_len;
+    } else {
+      wu.host = workload_url::no_host;
+      wu.path_off = add_string(u.p, u.len);
+      wu.path_len = u.len;
+    }
+    if(wu.path_len > longest_path)
+      longest_path = wu.path_len;
+  }
+
+  if(md5_file.length()) {
+    if(!md5.load(md5_file.c_str()))
+      die(strerror(errno), md5_file.c_str());
+    need_same_size(md5, md5_file.c_str());
+    digests.resize(16 * md5.size());
+    check_job j = { 0, 0 };
+    parallel_for(md5.size(), 65536, parse_md5s, &j);
+    if(j.bad) {
+      fprintf(stderr, "%s: bad MD5 %.*s\n", md5_file.c_str(), (int)md5[j.bad - 1].len, md5[j.bad - 1].p);
+      return 1;
+    }
+  }
+
+  if(local_file.length()) {
+    if(!local.load(local_file.c_str()))
+      die(strerror(errno), local_file.c_str());
+    need_same_size(local, local_file.c_str());
+    locals.resize(local.size());
+    for(size_t i = 0; i < local.size(); ++i) {
+      locals[i].off = add_string(local[i].p, local[i].len);
+      locals[i].len = local[i].len;
+      locals[i].pad = 0;
+    }
+    sizes.resize(local.size());
+    check_job j = { 0, 0 };
+    parallel_for(local.size(), 1024, stat_locals, &j);
+    if(j.bad) {
+      fprintf(stderr, "%.*s: %s\n", (int)local[j.bad - 1].len, local[j.bad - 1].p, strerror(j.err));
+      return 1;
+    }
+  }
+
+  if(size_file.length()) {
+    if(!size_list.load(size_file.c_str()))
+      die(strerror(errno), size_file.c_str());
+    need_same_size(size_list, size_file.c_str());
+    sizes.resize(size_list.size());
+    for(size_t i = 0; i < size_list.size(); ++i)
+      if(!parse_size(size_list[i], sizes[i])) {
+        fprintf(stderr, "%s: bad size %.*s\n", size_file.c_str(), (int)size_list[i].len, size_list[i].p);
+        return 1;
+      }
+  }
+
+  if(weights_file.length()) {
+    FILE *f = fopen(weights_file.c_str(), "r");
+    if(!f)
+      die(strerror(errno), weights_file.c_str());
+    weights.reserve(url.size());
+    double d;
+    while(fscanf(f, "%lf", &d) == 1)
+      weights.push_back(d);
+    fclose(f);
+    if(weights.size() != url.size())
+      die("must be the same size as the URL list", weights_file.c_str());
+  }
+
+  // the header goes in last, once the section offsets are known
+  FILE *f = fopen(out_file, "wb");
+  if(!f)
+    die(strerror(errno), out_file);
+  workload_header h;
+  memset(&h, 0, sizeof(h));
+  fwrite(&h, 1, sizeof(h), f);
+  memcpy(h.magic, WORKLOAD_MAGIC, sizeof(h.magic));
+  h.version = WORKLOAD_VERSION;
+  h.byte_order = WORKLOAD_BYTE_ORDER;
+  h.url_count = urls.size();
+  h.host_count = hosts.size();
+  h.longest_host = longest_host;
+  h.longest_path = longest_path;
+  h.hosts = write_section(f, hosts);
+  h.urls = write_section(f, urls);
+  if(!digests.empty())
+    h.md5s = write_section(f, digests);
+  if(!sizes.empty())
+    h.sizes = write_section(f, sizes);
+  if(!locals.empty())
+    h.locals = write_section(f, locals);
+  if(!weights.empty())
+    h.weights = write_section(f, weights);
+  h.strings = write_section(f, strings);
+  h.strings_len = strings.size();
+  h.file_size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  fwrite(&h, 1, sizeof(h), f);
+  bool bad = ferror(f) != 0; // before fclose() frees f
+  if(fclose(f) != 0 || bad)
+    die("write failed", out_file);
+
+  printf("%lu URLs on %lu hosts%s%s%s%s -> %s (%lu bytes)\n", (unsigned long)h.url_count,
+         (unsigned long)h.host_count, h.md5s ? ", md5s" : "", h.locals ? ", local files and sizes" : "",
+         h.sizes && !h.locals ? ", sizes" : "",
+         h.weights ? ", weights" : "", out_file, (unsigned long)h.file_size);
+  return 0;
+}
@@ -0,0 +1,129 @@
+/*
+  Copyright 2008-2013 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+// write a corpus of synthetic objects (see synthetic.hpp) for an
+// origin to serve, along with the URL and size lists testclient needs
+// to request and check them with --synthetic
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <string>
+#include <iostream>
+#include "options.hpp"
+#include "synthetic.hpp"
+
+int main(int argc, char **argv)
+{
+  options::add<bool>("help", "h", "Print usage information", "", false);
+  options::add<int>("count", "n", "Number of objects", "Corpus", 100);
+  options::add<int>("min-size", 0, "Smallest object, in bytes", "Corpus", 1024);
+  options::add<int>("max-size", 0, "Largest object, in bytes", "Corpus", 1048576);
+  options::add<int>("synthetic-key", 0, "Corpus key (testclient needs the same one)", "Corpus", 0);
+  options::add<int>("seed", 0, "Random seed for the object sizes", "Corpus", 1);
+  options::add<std::string>("url-prefix", 0, "URL of the output directory on the origin", "Output",
+                            "http://localhost");
+  options::add<std::string>("url-list", 0, "File to write the URL list to", "Output", "urls.dat");
+  options::add<std::string>("size-list", 0, "File to write the size list to", "Output", "sizes.dat");
+
+  int inpidx = options::parse_cmdline(argc, argv);
+  if(inpidx < 0)
+    return 1;
+  if(inpidx >= argc || options::quickget<bool>("help")) {
+    std::cerr << "Usage: " << argv[0] << " [options] output-dir" << std::endl;
+    options::print_options(std::cout);
+    return 1;
+  }
+  std::string dir = argv[inpidx], prefix = options::quickget<std::string>("url-prefix");
+  int count = options::quickget<int>("count");
+  long min_size = options::quickget<int>("min-size"), max_size = options::quickget<int>("max-size");
+  uint64_t corpus_key = (unsigned int)options::quickget<int>("synthetic-key");
+  if(min_size < 0 || max_size < min_size) {
+    std::cerr << "Need 0 <= min-size <= max-size" << std::endl;
+    return 1;
+  }
+
+  // the objects are named by the path part of their URLs
+  std::string path_prefix;
+  size_t scheme = prefix.find("://");
+  size_t slash = prefix.find('/', scheme == std::string::npos ? 0 : scheme + 3);
+  if(slash != std::string::npos)
+    path_prefix = prefix.substr(slash);
+  if(path_prefix.length() && path_prefix[path_prefix.length() - 1] == '/')
+    path_prefix.erase(path_prefix.length() - 1);
+  if(prefix.length() && prefix[prefix.length() - 1] == '/')
+    prefix.erase(prefix.length() - 1);
+
+  FILE *urls = fopen(options::quickget<std::string>("url-list").c_str(), "w");
+  FILE *sizes = fopen(options::quickget<std::string>("size-list").c_str(), "w");
+  if(!urls || !sizes) {
+    perror("opening lists");
+    return 1;
+  }
+
+  unsigned short rng[3] = { 0x330e, 0, 0 };
+  long seed = options::quickget<int>("seed");
+  rng[1] = seed & 0xffff;
+  rng[2] = (seed >> 16) & 0xffff;
+
+  static unsigned char buf[1 << 20];
+  for(int i = 0; i < count; ++i) {
+    char name[32];
+    snprintf(name, sizeof(name), "/%d.bin", i);
+    std::string path = path_prefix + name, file = dir + name;
+    long size = min_size + (long)(erand48(rng) * (max_size - min_size + 1));
+    if(size > max_size)
+      size = max_size;
+
+    FILE *f = fopen(file.c_str(), "wb");
+    if(!f) {
+      perror(file.c_str());
+      return 1;
+    }
+    uint64_t key = synthetic_key(corpus_key, path.data(), path.length());
+    for(long off = 0; off < size; off += sizeof(buf)) {
+      size_t n = size - off < (long)sizeof(buf) ? size - off : sizeof(buf);
+      synthetic_fill(key, off, buf, n);
+      fwrite(buf, 1, n, f);
+    }
+    bool bad = ferror(f) != 0; // before fclose() frees f
+    if(fclose(f) != 0 || bad) {
+      perror(file.c_str());
+      return 1;
+    }
+    fprintf(urls, "%s%s\n", prefix.c_str(), name);
+    fprintf(sizes, "%ld\n", size);
+  }
+  bool bad = ferror(urls) != 0;
+  bad = fclose(urls) != 0 || bad;
+  bad = ferror(sizes) != 0 || bad;
+  bad = fclose(sizes) != 0 || bad;
+  if(bad) {
+    perror("writing lists");
+    return 1;
+  }
+  return 0;
+}
@@ -30,7 +30,7 @@
   Kris Beevers
   kbeevers@voxel.net
 
-  REQUIRES libcurl 7.15.6 or higher.
+  REQUIRES libcurl 7.16.0 or higher, and Linux (for epoll).
 
   This thing takes a file with a list of URLs and then hits those URLs
   in various ways according to some options.
@@ -55,25 +55,41 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <time.h>
 #include <vector>
-#include <list>
-#include <map>
+#include <algorithm>
 #include <fstream>
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <limits.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <errno.h>
 #include <assert.h>
 #include <math.h>
+#include <pthread.h>
 #include <curl/curl.h>
 #include <openssl/evp.h>
 #include "options.hpp"
+#include "histogram.hpp"
+#include "alias.hpp"
+#include "linefile.hpp"
+#include "workload.hpp"
+#include "synthetic.hpp"
+#include "timers.hpp"
+#include "logger.hpp"
+#include "trace.hpp"
+#include "metrics.hpp"
+#include "cacherules.hpp"
+#include "loadprofile.hpp"
 
 // options
 int opt_connections = 80;   // max simultaneous requests to make
@@ -81,57 +97,253 @@ bool opt_reuse = false;     // reuse existing connections for new requests
 bool opt_random = true;     // select URLs at random, or sequentially?
 double opt_br_prob, opt_throttle_prob, opt_term_prob, opt_repeat_prob;
 int opt_throttle_min, opt_throttle_max;
+double opt_max_bandwidth;   // cap on the total download rate, bytes/sec (0 = none)
 double opt_term_min_sec, opt_term_weibull_k, opt_term_weibull_lambda;
 bool opt_verbose = false;   // dump vast quantities of debug output on request failure
 bool opt_no_checks = false; // no consistency checks, all output > /dev/null
-bool opt_quiet = false;
 double opt_random_qstring_prob; // prob to add a randomized query string parameter
+int opt_threads = 1;        // number of worker threads
+int opt_save_bytes;         // bytes of each response to keep for saving on failure
+double opt_rate;            // open loop: requests per second to start (0 = closed loop)
+bool opt_poisson = false;   // open loop: Poisson rather than evenly spaced arrivals
+bool opt_adapt = false;     // search for the most transactions the servers take within ...
+double opt_adapt_p99;       // ... this p99 time to first byte (ms, 0 = any)
+double opt_adapt_error_rate; // ... and this fraction of failed requests
+load_profile profile;       // with --profile, the phases of the run
+int opt_herd = 0;           // thundering herd: request each cold URL this many times at once
+unsigned int herd_nonce;    // ... marking their query strings as this run's
+unsigned long profile_phase; // ... the one we're in (written by the main thread)
+long opt_seed;              // random seed (workers use seed, seed + 1, ...)
+bool opt_server_stats = false; // count requests, errors and bytes per server
+int opt_metrics_port = 0;   // serve a metrics page on this port (0 = don't)
+bool opt_cache_stats = false; // tell cache hits from misses by the response headers ...
+cache_rules cache_rule_set; // ... with these rules
+double opt_status_interval = 1.0; // seconds between status lines
+trace_file trace;           // with --trace, a record of every finished transaction
+uint64_t run_start;         // when the workers started (ns)
+int opt_local_files = 64;   // idle local files each worker keeps mapped for verification
+bool opt_synthetic = false; // check content against synthetic objects (see synthetic.hpp)
+uint64_t opt_synthetic_key; // ... made with this corpus key
+
+// how popular each URL is when choosing at random
+enum { POP_UNIFORM, POP_ZIPF, POP_WEIGHTS, POP_HOTSET };
+int opt_popularity = POP_UNIFORM;
+double opt_zipf_alpha, opt_hot_fraction, opt_hot_prob;
+
+
+// input data; the URL and local file lists are views into the mapped
+// files, and so are the hosts split off the URLs when there's a
+// server list (the URLs are then narrowed to their paths)
+struct digest_t { unsigned char d[16]; };
+line_file url, local;
+std::vector<line_t> hosts;
+std::vector<digest_t> md5;    // binary, from the hex in the md5 list
+std::vector<int64_t> object_sizes; // from the size list, or of the local files (-1 if missing)
+std::vector<std::string> servers;
+std::vector<double> server_weights;
+workload compiled;            // instead of the lists, if given a compiled workload
+bool use_compiled = false;
 
+// what we know about URL i, from the lists or the compiled workload.
+// with the lists and no server list, the host is left empty and the
+// path is the whole URL.
+inline line_t url_host(unsigned int i)
+{
+  if(use_compiled)
+    return compiled.host(i);
+  if(!hosts.empty())
+    return hosts[i];
+  line_t none = { "", 0 };
+  return none;
+}
 
-// input data
-std::vector<std::string> url, md5, local, servers, hosts;
-std::vector<double> server_weights;
+inline line_t url_path(unsigned int i)
+{
+  return use_compiled ? compiled.path(i) : url[i];
+}
+
+inline const unsigned char * url_md5(unsigned int i)
+{
+  return use_compiled ? compiled.md5(i) : md5[i].d;
+}
+
+inline line_t url_local(unsigned int i)
+{
+  return use_compiled ? compiled.local(i) : local[i];
+}
+
+inline int64_t url_object_size(unsigned int i)
+{
+  return use_compiled ? (int64_t)compiled.object_size(i) : object_sizes[i];
+}
+
+inline bool have_object_sizes()
+{
+  return use_compiled ? compiled.has_sizes() : !object_sizes.empty();
+}
+
+// the path part of URL i (from the first '/' after the host), which
+// is what names a synthetic object
+line_t object_path(unsigned int i)
+{
+  line_t p = url_path(i);
+  if(url_host(i).len == 0 && p.len > 7 && !strncmp(p.p, "http://", 7)) {
+    const char *sl = (const char *)memchr(p.p + 7, '/', p.len - 7);
+    unsigned int skip = sl ? sl - p.p : p.len;
+    p.p += skip;
+    p.len -= skip;
+  }
+  return p;
+}
+
+// URL i as it was given, for log messages; the buffer is per thread,
+// so use one of these per message
+const char * url_name(unsigned int i)
+{
+  static __thread char name[4096];
+  line_t host = url_host(i), path = url_path(i);
+  if(host.len)
+    snprintf(name, sizeof(name), "http://%.*s%.*s", (int)host.len, host.p, (int)path.len, path.p);
+  else
+    snprintf(name, sizeof(name), "%.*s", (int)path.len, path.p);
+  return name;
+}
+alias_table server_choice;    // for picking a server according to its weight
 unsigned int url_size, md5_size, local_size;
+unsigned int url_string_size; // room for the longest URL we can generate
+alias_table url_popularity;   // for zipf and weights popularity
+unsigned int hot_size;        // for hotset popularity: URLs [0, hot_size) are hot
+
+
+struct worker_t;
+
+// a token bucket for shaping a download to a rate: tokens (bytes)
+// accrue at the rate up to a small burst, and content is let through
+// while there are any, which can leave the bucket in debt by up to a
+// chunk; after that the transfer waits until it's paid off
+struct token_bucket
+{
+  double rate, depth, tokens;
+  uint64_t stamp;             // when tokens was last brought up to date (ns)
+
+  void start(double r, uint64_t now)
+  {
+    rate = r;
+    depth = r * 0.05; // 50ms worth
+    tokens = depth;
+    stamp = now;
+  }
+
+  void refill(uint64_t now)
+  {
+    tokens += rate * ((now - stamp) / 1e9);
+    if(tokens > depth)
+      tokens = depth;
+    stamp = now;
+  }
 
+  // when the debt will be paid off
+  uint64_t when_positive() const
+  {
+    return tokens > 0 ? stamp : stamp + uint64_t(ceil(-tokens * 1e9 / rate)) + 1;
+  }
+};
 
+// transactions live in a fixed table of slots per worker, sized to
+// the worker's share of --num-transactions; each slot owns its
+// buffers for as long as the worker runs, so starting and finishing a
+// request doesn't allocate anything
 struct transaction_t
 {
   transaction_t();
   ~transaction_t();
 
+  void init(worker_t *worker); // allocate the slot's buffers
+  void reset();                // clear per-request state
+
+  worker_t *w;
+  bool in_use;
   CURL *curl;
   curl_slist *headers;
+  curl_slist header_list[2];  // storage for the headers list
   int url_id;
+  int server_id;              // index into servers, or -1 if there's no server list
   char *url_string;
   char outfile_name[128];
   FILE *outfile, *outfile_headers, *outfile_aux;
+  EVP_MD_CTX *mdctx;          // running md5 of the content, when checking
+  int truth;                  // for a range: the local copy mapping it's compared against, or -1
+  size_t truth_start;         // where in the local copy the content starts
+  size_t mismatch_at;         // 1 + offset of the first byte that differs from it, or 0
+  bool whole_file;            // asked for a range, but got the whole file
+  bool synthetic;             // compared against a synthetic object as it arrives
+  uint64_t synthetic_key;     // ... with this key
+  unsigned char *saved;       // ring of the last opt_save_bytes bytes of content
   char error[CURL_ERROR_SIZE];
-  time_t start;
+  uint64_t started, intended; // when we started, and when we meant to (ns)
   size_t bytes_sent;
   int byterange_start, byterange_end;
   char byterange_header[128];
   char host_header[128];
   int throttle_bytes_per_sec;
-  bool currently_throttling;
+  token_bucket shaper;        // ... shaped with this
+  bool currently_throttling;  // paused, for its own rate or the bandwidth cap
+  bool waiting_for_cap;       // ... on the cap's list of transfers to resume
+  int burst;                  // with --herd, its burst in the worker's table
+  bool md5_done;              // the running md5 has been finished into digest
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  int cache_verdict;          // with --cache-stats: CACHE_HIT etc., from the headers so far
+  int cache_rule;             // ... the rule that decided it, or -1
   double random_terminate_time;
 };
 
 transaction_t::transaction_t()
 {
+  w = 0;
+  url_string = 0;
+  mdctx = 0;
+  saved = 0;
+  reset();
+}
+
+void transaction_t::init(worker_t *worker)
+{
+  w = worker;
+  url_string = new char[url_string_size];
+  if(!opt_no_checks) {
+    mdctx = EVP_MD_CTX_create();
+    if(opt_save_bytes > 0)
+      saved = new unsigned char[opt_save_bytes];
+  }
+}
+
+void transaction_t::reset()
+{
+  in_use = false;
   curl = NULL;
   headers = NULL;
   url_id = -1;
-  url_string = 0;
+  server_id = -1;
+  truth = -1;
+  truth_start = mismatch_at = 0;
+  whole_file = false;
+  synthetic = false;
+  synthetic_key = 0;
   outfile_name[0] = 0;
   outfile = outfile_headers = outfile_aux = 0;
   error[0] = 0;
-  start = 0;
+  started = intended = 0;
   bytes_sent = 0;
   byterange_start = byterange_end = 0;
   byterange_header[0] = 0;
   host_header[0] = 0;
   throttle_bytes_per_sec = 0;
   currently_throttling = false;
+  waiting_for_cap = false;
+  burst = -1;
+  md5_done = false;
+  cache_verdict = CACHE_UNKNOWN;
+  cache_rule = -1;
   random_terminate_time = 0.0;
 }
 
@@ -139,201 +351,708 @@ transaction_t::~transaction_t()
 {
   if(url_string)
     delete [] url_string;
+  if(mdctx)
+    EVP_MD_CTX_destroy(mdctx);
+  if(saved)
+    delete [] saved;
+}
+
+
+// each worker thread runs its own event loop over its own share of
+// the transactions, with its own multi handle and random number
+// generator; the input data above is shared, but read-only
+struct worker_t
+{
+  worker_t();
+
+  int id;
+  pthread_t thread;
+  CURLM *curl;
+  int epfd;                 // epoll descriptor for the sockets curl cares about
+  uint64_t curl_deadline;   // when curl wants a timeout action (0 = never)
+  transaction_t *slots;     // the transaction table
+  std::vector<int> idle;    // indices of slots not in use
+  int connections;          // this worker's share of opt_connections
+  unsigned long limit;      // how many of them may be in use at once; set by
+                            // the main thread (with gauge()) for --adapt and --profile
+  unsigned long arrival_mean; // open loop: average ns between this worker's arrivals
+                            // (set the same way, for --profile)
+  unsigned long gap_seen;   // ... as of the last arrival we scheduled
+  traffic_mix mix;          // the probabilities for this worker's requests
+  unsigned long phase;      // ... from this phase of the profile
+  int cur_url, prev_url;
+  unsigned short rng[3];    // state for erand48/nrand48
+  uint64_t next_arrival;    // open loop: when the next request is due (ns)
+  CURL *template_handle;    // invariant options, copied into the pool
+  std::vector<CURL *> handles; // pool of idle easy handles
+
+  // when each transaction is due to be terminated, or resumed after
+  // throttling (see timer_id()), so the event loop only touches the
+  // transactions whose time has come
+  timer_heap timers;
+  int throttled;            // transactions currently paused
+
+  // with --max-bandwidth, this worker's share of the cap, and the
+  // transactions paused until it has room (slot indices)
+  token_bucket cap;
+  std::vector<int> cap_waiting;
+
+  // local files mapped for verifying byte ranges; the least recently
+  // used one that no transaction is comparing against goes first (see
+  // local_map())
+  struct local_map_t {
+    int url_id;
+    const unsigned char *p;
+    size_t len;
+    int refs;
+    uint64_t used;
+  };
+  std::vector<local_map_t> local_maps;
+  uint64_t local_map_clock;
+
+  // running totals and gauges, written only by this worker (see
+  // bump()) and read by the status loop in the main thread; kept on
+  // their own cache line so the reads don't disturb the writer
+  struct {
+    unsigned long done, bytes;
+    unsigned long transactions, throttling;
+    unsigned long late;     // open loop: requests started behind schedule
+  } stats __attribute__((aligned(64)));
+
+  // how the finished transactions came out, for the metrics page
+  // (same rules as stats)
+  struct {
+    unsigned long terminated, throttled;
+    unsigned long results[TRACE_RESULTS];   // how their checks came out
+    unsigned long curl_errors[CURL_LAST];
+    unsigned long statuses[600];            // by HTTP status (0 for none)
+  } outcomes;
+
+  // latency of completed transfers, in microseconds; written only by
+  // this worker, snapshotted by the status loop
+  histogram latency[LAT_PHASES];
+
+  // with --server-stats or --metrics-port, one set of counters per
+  // server (same rules as stats), with the total time of its
+  // completed transfers
+  struct server_stats_t {
+    unsigned long requests, errors, bytes;
+    histogram latency;
+  } *server_stats;
+
+  // with --cache-stats, one set for each cache verdict (same rules
+  // again), with the latency of its completed transfers
+  struct cache_stats_t {
+    unsigned long requests, bytes;
+    histogram latency[LAT_PHASES];
+  } *cache_stats;
+  cache_rules *cache_rule_copy; // this thread's own copy of cache_rule_set
+
+  // with --herd, bursts of requests for the same URL, started together
+  // (each takes --herd slots), and how the responses compared
+  struct burst_t {
+    int url_id, server_id;
+    char *url_string;       // built once, so every request asks for exactly this
+    uint64_t started;
+    int left;               // requests still going
+    int ok, errors, differ, misses;
+    long status;            // the first good response, for the others to match
+    size_t bytes;
+    unsigned char digest[16];
+    uint64_t first_byte[2], done[2]; // earliest and latest (ns)
+  };
+  std::vector<burst_t> bursts;
+  std::vector<int> idle_bursts;
+  bool herd_wrapped;        // we've been through our share of the URLs
+  unsigned int herd_count;  // bursts so far
+
+  // ... and the finished bursts (same rules as stats): how many,
+  // how many got responses that differed or failed, how many the
+  // cache answered with at most one miss, and the spread between the
+  // earliest and latest first byte, and completion, in microseconds
+  struct herd_stats_t {
+    unsigned long bursts, inconsistent, failed, collapsed;
+    histogram spread[2];
+  } *herd_stats;
+};
+
+worker_t::worker_t()
+{
+  id = 0;
+  curl = 0;
+  epfd = -1;
+  curl_deadline = 0;
+  slots = 0;
+  connections = 0;
+  limit = 0;
+  arrival_mean = gap_seen = 0;
+  memset(&mix, 0, sizeof(mix));
+  phase = 0;
+  cur_url = prev_url = 0;
+  rng[0] = rng[1] = rng[2] = 0;
+  next_arrival = 0;
+  template_handle = 0;
+  throttled = 0;
+  local_map_clock = 0;
+  stats.done = stats.bytes = 0;
+  stats.transactions = stats.throttling = 0;
+  stats.late = 0;
+  memset(&outcomes, 0, sizeof(outcomes));
+  server_stats = 0;
+  cache_stats = 0;
+  cache_rule_copy = 0;
+  herd_wrapped = false;
+  herd_count = 0;
+  herd_stats = 0;
 }
 
+worker_t *workers = 0;
+volatile sig_atomic_t quitting = 0; // set by the signal handler
 
-CURLM *curl = 0;
-std::list<transaction_t> T;
-std::map<CURL *, std::list<transaction_t>::iterator> curl_to_T;
-int cur_url = 0;
-char outfile_extra_name[128];
-unsigned int bytes_since_last = 0, bytes = 0;
 
+// update a counter in worker_t::stats; only the owning worker writes
+// these, so a plain (but untorn) store is all it takes
+inline void bump(unsigned long &c, unsigned long n = 1)
+{
+  __atomic_store_n(&c, c + n, __ATOMIC_RELAXED);
+}
 
-// print timestamp, then log line, then newline
-void mylog(const char *fmt, ...)
+inline void gauge(unsigned long &c, unsigned long v)
 {
-  char timestamp[100];
-  time_t t = time(0);
-  struct tm *tmp = localtime(&t);
-  strftime(timestamp, 100, "%m/%d/%Y %H:%M:%S", tmp);
-  va_list args;
-  va_start(args, fmt);
-  printf("[%s] ", timestamp);
-  vprintf(fmt, args);
-  printf("\n");
-  va_end(args);
+  __atomic_store_n(&c, v, __ATOMIC_RELAXED);
+}
+
+inline unsigned long peek(const unsigned long &c)
+{
+  return __atomic_load_n(&c, __ATOMIC_RELAXED);
+}
+
+
+// each transaction slot has two timers in its worker's heap, and
+// after those there's one for the bandwidth cap
+enum { TIMER_TERMINATE, TIMER_THROTTLE, TIMERS_PER_SLOT };
+
+inline unsigned int timer_id(worker_t *w, transaction_t *t, int which)
+{
+  return (t - w->slots) * TIMERS_PER_SLOT + which;
+}
+
+inline unsigned int cap_timer_id(worker_t *w)
+{
+  return w->connections * TIMERS_PER_SLOT;
+}
+
+
+// monotonic clock, in nanoseconds
+uint64_t now_nsec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return uint64_t(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+// called by curl whenever it wants us to start, change, or stop
+// watching a socket; keep the worker's epoll set in sync.  socketp is
+// non-null once we have registered the socket with epoll.
+int socket_callback(CURL *easy, curl_socket_t s, int what, void *userp, void *socketp)
+{
+  worker_t *w = (worker_t *)userp;
+  struct epoll_event ev;
+  ev.events = 0;
+  ev.data.fd = s;
+
+  if(what == CURL_POLL_REMOVE) {
+    // curl may already have closed the socket, in which case the
+    // kernel has dropped it from the epoll set for us
+    epoll_ctl(w->epfd, EPOLL_CTL_DEL, s, &ev);
+    return 0;
+  }
+
+  if(what & CURL_POLL_IN)
+    ev.events |= EPOLLIN;
+  if(what & CURL_POLL_OUT)
+    ev.events |= EPOLLOUT;
+
+  if(epoll_ctl(w->epfd, socketp ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, s, &ev) < 0) {
+    mylog(LOG_ERROR, "error: epoll_ctl (%d)", errno);
+    exit(1);
+  }
+  if(!socketp)
+    curl_multi_assign(w->curl, s, &w->epfd);
+  return 0;
+}
+
+// called by curl to tell us when it next wants a timeout action
+int timer_callback(CURLM *multi, long timeout_ms, void *userp)
+{
+  worker_t *w = (worker_t *)userp;
+  if(timeout_ms < 0)
+    w->curl_deadline = 0;
+  else
+    w->curl_deadline = now_nsec() + uint64_t(timeout_ms) * 1000000ULL;
+  return 0;
+}
+
+// called from the write callbacks before taking any content: charge
+// it to the transfer's token bucket and the worker's share of the
+// bandwidth cap.  returns false if either is in debt, in which case
+// the transfer is paused (curl keeps the content and hands it to us
+// again when we resume it) and a timer set to resume it when the debt
+// is paid.  pausing stops curl reading the socket, so the server sees
+// a slow client, not one that's gone away.
+inline bool shape(transaction_t *t, size_t b)
+{
+  if(!t->throttle_bytes_per_sec && !opt_max_bandwidth)
+    return true;
+  worker_t *w = t->w;
+  uint64_t now = now_nsec();
+
+  if(t->throttle_bytes_per_sec) {
+    t->shaper.refill(now);
+    if(t->shaper.tokens <= 0) {
+      t->currently_throttling = true;
+      ++w->throttled;
+      w->timers.set(timer_id(w, t, TIMER_THROTTLE), t->shaper.when_positive());
+      return false;
+    }
+  }
+  if(opt_max_bandwidth) {
+    w->cap.refill(now);
+    if(w->cap.tokens <= 0) {
+      t->currently_throttling = true;
+      ++w->throttled;
+      t->waiting_for_cap = true;
+      w->cap_waiting.push_back(t - w->slots);
+      w->timers.set(cap_timer_id(w), w->cap.when_positive());
+      return false;
+    }
+    w->cap.tokens -= b;
+  }
+  if(t->throttle_bytes_per_sec)
+    t->shaper.tokens -= b;
+  return true;
+}
+
+// let a paused transfer go again; curl may call the write callback
+// (and so shape()) before this returns
+void resume(worker_t *w, transaction_t *t)
+{
+  t->currently_throttling = false;
+  --w->throttled;
+  if(curl_easy_pause(t->curl, CURLPAUSE_CONT) != CURLE_OK) {
+    mylog(LOG_ERROR, "error: curl_easy_pause");
+    exit(1);
+  }
+}
+
+inline void received(transaction_t *t, size_t b)
+{
+  bump(t->w->stats.bytes, b);
+  t->bytes_sent += b;
 }
 
 size_t discard_data(void *data, size_t sz, size_t nmemb, void *stream)
 {
   size_t b = sz * nmemb;
-  bytes_since_last += b;
-  ((transaction_t *)stream)->bytes_sent += b;
+  transaction_t *t = (transaction_t *)stream;
+  if(!shape(t, b))
+    return CURL_WRITEFUNC_PAUSE;
+  received(t, b);
   return b;
 }
 
-// assumes weights are normalized
-unsigned int weighted_round_robin(const std::vector<double> &weights)
+// hash the content as it arrives instead of writing it out and
+// reading it back, and keep the most recent bytes around in case the
+// check fails and we want to look at them
+size_t verify_data(void *data, size_t sz, size_t nmemb, void *stream)
 {
-  double d = drand48();
-  for(unsigned int i = 0; i < weights.size(); d -= weights[i], ++i)
-    if(d < 0)
-      return i;
-  return 0; // should never happen
+  size_t b = sz * nmemb;
+  transaction_t *t = (transaction_t *)stream;
+  if(!shape(t, b))
+    return CURL_WRITEFUNC_PAUSE;
+
+  if(t->truth >= 0 || t->synthetic) {
+    // a range of a local file, or a synthetic object: compare it with
+    // the truth as it arrives.  the first bytes tell us whether the
+    // server sent the range or (refusing the range) the whole file.
+    if(t->bytes_sent == 0) {
+      long code = 0;
+      curl_easy_getinfo(t->curl, CURLINFO_RESPONSE_CODE, &code);
+      t->whole_file = code == 200;
+      t->truth_start = t->whole_file ? 0 : t->byterange_start;
+    }
+    size_t off = t->truth_start + t->bytes_sent;
+    if(t->synthetic) {
+      if(!t->mismatch_at) {
+        size_t ok = synthetic_check(t->synthetic_key, off, (const unsigned char *)data, b);
+        if(ok < b)
+          t->mismatch_at = off + ok + 1;
+      }
+    } else if(!t->mismatch_at) {
+      const worker_t::local_map_t &m = t->w->local_maps[t->truth];
+      if(off + b > m.len) // more than the local copy has
+        t->mismatch_at = (off < m.len ? m.len : off) + 1;
+      else if(memcmp(data, m.p + off, b)) {
+        const unsigned char *d = (const unsigned char *)data;
+        size_t i = 0;
+        while(d[i] == m.p[off + i])
+          ++i;
+        t->mismatch_at = off + i + 1;
+      }
+    }
+  } else
+    EVP_DigestUpdate(t->mdctx, data, b);
+
+  // a burst's responses are compared with each other by their digests
+  if(t->burst >= 0 && (t->truth >= 0 || t->synthetic))
+    EVP_DigestUpdate(t->mdctx, data, b);
+
+  if(opt_save_bytes > 0) {
+    const unsigned char *d = (const unsigned char *)data;
+    size_t n = b, pos = t->bytes_sent % opt_save_bytes;
+    if(n > (size_t)opt_save_bytes) { // only the tail will survive anyway
+      d += n - opt_save_bytes;
+      pos = (pos + n - opt_save_bytes) % opt_save_bytes;
+      n = opt_save_bytes;
+    }
+    size_t first = n < opt_save_bytes - pos ? n : opt_save_bytes - pos;
+    memcpy(t->saved + pos, d, first);
+    memcpy(t->saved, d + first, n - first);
+  }
+
+  received(t, b);
+  return b;
 }
 
-void generate_url(unsigned int url_id, char **url_string)
+// the response headers: with --cache-stats, see what the cache rules
+// make of each one as it arrives, and with --verbose, save them too
+size_t header_data(char *data, size_t sz, size_t nmemb, void *stream)
 {
-  unsigned int len = url[url_id].length();
-
-  if(!servers.empty())
-    len += 7 + 15 + 6; // 'http://' + 'xxx.xxx.xxx.xxx' + ':ppppp' if specified
+  size_t b = sz * nmemb;
+  transaction_t *t = (transaction_t *)stream;
+  if(opt_cache_stats)
+    t->w->cache_rule_copy->classify(data, b, t->cache_rule, t->cache_verdict);
+  if(t->outfile_headers)
+    return fwrite(data, 1, b, t->outfile_headers);
+  return b;
+}
 
-  static char qstring[14];
+// build the URL into the slot's buffer, which has room for
+// url_string_size characters; returns the server chosen, or -1 if
+// there's no server list
+int generate_url(worker_t *w, unsigned int url_id, char *url_string)
+{
+  char qstring[32];
   qstring[0] = 0;
-  if(opt_random_qstring_prob > 0.0 && drand48() < opt_random_qstring_prob)
-    sprintf(qstring, "?q=%d", (unsigned int)(drand48() * 10000000));
+  if(w->mix.qstring_prob > 0.0 && erand48(w->rng) < w->mix.qstring_prob) {
+    if(opt_herd) // for a burst: a key no cache can have seen, new every run
+      snprintf(qstring, sizeof(qstring), "?h=%x.%x.%x", herd_nonce, w->id, w->herd_count);
+    else
+      sprintf(qstring, "?q=%d", (unsigned int)(erand48(w->rng) * 10000000));
+  }
 
-  *url_string = new char[len + strlen(qstring) + 1];
+  line_t path = url_path(url_id);
   if(servers.empty()) {
     // just use the url as specified in the urls file
-    sprintf(*url_string, "%s%s", url[url_id].c_str(), qstring);
-  } else {
-    // construct a url from the path in urls and a server from the
-    // servers file
-    unsigned int server_id = weighted_round_robin(server_weights);
-    sprintf(*url_string, "http://%s%s%s", servers[server_id].c_str(), url[url_id].c_str(), qstring);
+    line_t host = url_host(url_id);
+    if(host.len)
+      snprintf(url_string, url_string_size, "http://%.*s%.*s%s", (int)host.len, host.p,
+               (int)path.len, path.p, qstring);
+    else
+      snprintf(url_string, url_string_size, "%.*s%s", (int)path.len, path.p, qstring);
+    return -1;
   }
+
+  // construct a url from the path in urls and a server from the
+  // servers file
+  unsigned int server_id = server_choice.sample(w->rng);
+  snprintf(url_string, url_string_size, "http://%s%.*s%s", servers[server_id].c_str(),
+           (int)path.len, path.p, qstring);
+  return server_id;
 }
 
-void setup_transaction(transaction_t &t)
+// set the options that are the same for every request; this is done
+// once on a template handle, and the handles in each worker's pool
+// are copies of it
+CURL * make_template_handle()
 {
-  t.curl = curl_easy_init();
-  if(t.curl == NULL) {
-    mylog("error: curl_easy_init");
+  CURL *c = curl_easy_init();
+  if(c == NULL) {
+    mylog(LOG_ERROR, "error: curl_easy_init");
     exit(1);
   }
 
   if(!opt_no_checks) {
-    // dump the content to t.outfile
-    if(curl_easy_setopt(t.curl, CURLOPT_WRITEDATA, t.outfile) != CURLE_OK)
+    // hash the content as it comes in
+    if(curl_easy_setopt(c, CURLOPT_WRITEFUNCTION, verify_data) != CURLE_OK)
       goto setopt_error;
   } else {
     // use our custom output function to discard the output without
     // any slowdowns from writing it to a file descriptor (faster than
     // setting t.outfile to /dev/null)
-    if(curl_easy_setopt(t.curl, CURLOPT_WRITEFUNCTION, discard_data) != CURLE_OK)
-      goto setopt_error;
-    // pass this transaction to discard_data so we can increment byte
-    // counts
-    if(curl_easy_setopt(t.curl, CURLOPT_WRITEDATA, &t) != CURLE_OK)
+    if(curl_easy_setopt(c, CURLOPT_WRITEFUNCTION, discard_data) != CURLE_OK)
       goto setopt_error;
   }
 
-  if(opt_verbose) {
-    // dump the headers to t.outfile_headers
-    if(curl_easy_setopt(t.curl, CURLOPT_WRITEHEADER, t.outfile_headers) != CURLE_OK)
+  if(opt_verbose || opt_cache_stats) {
+    // headers go to a function of their own; curl would otherwise
+    // pass them to our write function along with the content
+    if(curl_easy_setopt(c, CURLOPT_HEADERFUNCTION, header_data) != CURLE_OK)
       goto setopt_error;
+  }
 
+  if(opt_verbose) {
     // dump debug output to the aux file
-    if(curl_easy_setopt(t.curl, CURLOPT_VERBOSE, 1) != CURLE_OK)
-      goto setopt_error;
-    if(curl_easy_setopt(t.curl, CURLOPT_STDERR, t.outfile_aux) != CURLE_OK)
+    if(curl_easy_setopt(c, CURLOPT_VERBOSE, 1) != CURLE_OK)
       goto setopt_error;
   }
 
   // 5 sec connection timeout, no transfer timeout
-  if(curl_easy_setopt(t.curl, CURLOPT_CONNECTTIMEOUT, 5) != CURLE_OK)
+  if(curl_easy_setopt(c, CURLOPT_CONNECTTIMEOUT, 5) != CURLE_OK)
     goto setopt_error;
 
   // fail on error!
-  if(curl_easy_setopt(t.curl, CURLOPT_FAILONERROR, 1) != CURLE_OK)
+  if(curl_easy_setopt(c, CURLOPT_FAILONERROR, 1) != CURLE_OK)
     goto setopt_error;
 
-  // give me error!
-  if(curl_easy_setopt(t.curl, CURLOPT_ERRORBUFFER, t.error) != CURLE_OK)
+  // do not cache dns
+  if(curl_easy_setopt(c, CURLOPT_DNS_CACHE_TIMEOUT, 0) != CURLE_OK)
     goto setopt_error;
 
-  // set the url to hit
-  generate_url(t.url_id, &t.url_string);
-  if(curl_easy_setopt(t.curl, CURLOPT_URL, t.url_string) != CURLE_OK)
+  // we have several threads, so curl mustn't use signals for timeouts
+  if(curl_easy_setopt(c, CURLOPT_NOSIGNAL, 1) != CURLE_OK)
     goto setopt_error;
 
-  // if we have a specific host set for this request, set a Host
-  // header
-  if(!hosts.empty()) {
-    snprintf(t.host_header, 100, "Host: %s", hosts[t.url_id].c_str());
-    t.host_header[99] = '\0';
-    t.headers = curl_slist_append(t.headers, t.host_header);
+  if(!opt_reuse) {
+    // don't reuse connections for multiple requests
+    if(curl_easy_setopt(c, CURLOPT_FORBID_REUSE, 1) != CURLE_OK)
+      goto setopt_error;
   }
 
-  // set byte range header if necessary
-  if(t.byterange_end) {
-    snprintf(t.byterange_header, 100, "Range: bytes=%d-%d", t.byterange_start, t.byterange_end);
-    t.byterange_header[99] = '\0';
-    t.headers = curl_slist_append(t.headers, t.byterange_header);
+  return c;
+ setopt_error:
+  mylog(LOG_ERROR, "error: curl_easy_setopt");
+  exit(1);
+}
+
+// take an easy handle from the worker's pool, making a new one if
+// the pool has run dry
+CURL * acquire_handle(worker_t *w)
+{
+  if(w->handles.empty()) {
+    CURL *c = curl_easy_duphandle(w->template_handle);
+    if(c == NULL) {
+      mylog(LOG_ERROR, "error: curl_easy_duphandle");
+      exit(1);
+    }
+    return c;
   }
+  CURL *c = w->handles.back();
+  w->handles.pop_back();
+  return c;
+}
 
-  if(!hosts.empty() || t.byterange_end)
-    if(curl_easy_setopt(t.curl, CURLOPT_HTTPHEADER, t.headers) != CURLE_OK)
-      goto setopt_error;
+// return a handle to the pool once curl is done with it; it keeps its
+// buffers and the invariant options for the next request
+void release_handle(worker_t *w, CURL *c)
+{
+  w->handles.push_back(c);
+}
 
-  // do not cache dns
-  if(curl_easy_setopt(t.curl, CURLOPT_DNS_CACHE_TIMEOUT, 0) != CURLE_OK)
+// set the per-request options on a pooled handle; everything set
+// here has to be set for every request, since the handle still holds
+// whatever the previous request used
+void setup_transaction(transaction_t &t)
+{
+  t.curl = acquire_handle(t.w);
+
+  // pass this transaction to the write function so we can update
+  // digests and byte counts, and keep it with the handle so we can
+  // find it again when curl is done
+  if(curl_easy_setopt(t.curl, CURLOPT_WRITEDATA, &t) != CURLE_OK ||
+     curl_easy_setopt(t.curl, CURLOPT_PRIVATE, &t) != CURLE_OK)
     goto setopt_error;
 
-  if(!opt_reuse) {
-    // don't reuse connections for multiple requests
-    if(curl_easy_setopt(t.curl, CURLOPT_FORBID_REUSE, 1) != CURLE_OK)
+  if(opt_verbose || opt_cache_stats) {
+    // and the headers go to the header function, with the transaction
+    if(curl_easy_setopt(t.curl, CURLOPT_HEADERDATA, &t) != CURLE_OK)
+      goto setopt_error;
+  }
+
+  if(opt_verbose) {
+    // dump debug output to the aux file
+    if(curl_easy_setopt(t.curl, CURLOPT_STDERR, t.outfile_aux) != CURLE_OK)
       goto setopt_error;
   }
 
+  // give me error!
+  t.error[0] = 0;
+  if(curl_easy_setopt(t.curl, CURLOPT_ERRORBUFFER, t.error) != CURLE_OK)
+    goto setopt_error;
+
+  // set the url to hit; a burst's requests all ask for the same one
+  if(t.burst >= 0) {
+    const worker_t::burst_t &b = t.w->bursts[t.burst];
+    strcpy(t.url_string, b.url_string);
+    t.server_id = b.server_id;
+  } else
+    t.server_id = generate_url(t.w, t.url_id, t.url_string);
+  if(curl_easy_setopt(t.curl, CURLOPT_URL, t.url_string) != CURLE_OK)
+    goto setopt_error;
+
+  // the headers list is built from the slot's own nodes rather than
+  // with curl_slist_append, which would allocate
+  {
+    curl_slist **tail = &t.headers;
+
+    // if we have a specific host set for this request, set a Host
+    // header
+    line_t host = url_host(t.url_id);
+    if(!servers.empty() && host.len) {
+      snprintf(t.host_header, 100, "Host: %.*s", (int)host.len, host.p);
+      t.host_header[99] = '\0';
+      t.header_list[0].data = t.host_header;
+      *tail = &t.header_list[0];
+      tail = &t.header_list[0].next;
+    }
+
+    // set byte range header if necessary
+    if(t.byterange_end) {
+      snprintf(t.byterange_header, 100, "Range: bytes=%d-%d", t.byterange_start, t.byterange_end);
+      t.byterange_header[99] = '\0';
+      t.header_list[1].data = t.byterange_header;
+      *tail = &t.header_list[1];
+      tail = &t.header_list[1].next;
+    }
+
+    *tail = NULL;
+  }
+
+  // (clearing any headers left over from the previous request)
+  if(curl_easy_setopt(t.curl, CURLOPT_HTTPHEADER, t.headers) != CURLE_OK)
+    goto setopt_error;
+
   return;
  setopt_error:
-  mylog("error: curl_easy_setopt");
+  mylog(LOG_ERROR, "error: curl_easy_setopt");
   exit(1);
 }
 
-void md5_compute(FILE *f, int start, int end, std::string &md5)
+// hex representation of an md5 digest; hex needs room for 33 chars
+void digest_to_hex(const unsigned char *md_val, char *hex)
 {
-  // initialize openssl md5 digest
-  static unsigned char data[102400]; // 100K buffer to read from file
-  static unsigned char md_val[EVP_MAX_MD_SIZE];
-  unsigned int md_len;
-  EVP_MD_CTX mdctx;
-  const EVP_MD *md = EVP_md5();
-  EVP_MD_CTX_init(&mdctx);
-  EVP_DigestInit_ex(&mdctx, md, NULL);
+  static const char digits[] = "0123456789abcdef";
+  for(unsigned int i = 0; i < 16; ++i) {
+    hex[2 * i] = digits[md_val[i] >> 4];
+    hex[2 * i + 1] = digits[md_val[i] & 0xf];
+  }
+  hex[32] = 0;
+}
 
-  // read data in chunks from the file and update the digest
-  size_t rv;
-  if(fseek(f, start, SEEK_SET) != 0) {
-    mylog("error: fseek");
-    exit(1);
+// local file names aren't NUL-terminated in the mapped list, so copy
+// one into buf (PATH_MAX bytes) before handing it to the system
+const char * local_name(unsigned int url_id, char *buf)
+{
+  line_t l = url_local(url_id);
+  unsigned int n = l.len < PATH_MAX ? l.len : PATH_MAX - 1;
+  memcpy(buf, l.p, n);
+  buf[n] = 0;
+  return buf;
+}
+
+// the slot in the worker's table with a mapping of URL i's local file,
+// or -1 if it can't be mapped; the caller holds a reference until it
+// calls unmap_local().  the worker keeps the last opt_local_files
+// idle mappings around, so popular files are mapped once rather than
+// once per request.  the table is small enough that a linear scan
+// beats anything cleverer.
+int local_map(worker_t *w, unsigned int url_id)
+{
+  int victim = -1;
+  for(unsigned int i = 0; i < w->local_maps.size(); ++i) {
+    worker_t::local_map_t &m = w->local_maps[i];
+    if(m.url_id == (int)url_id) {
+      ++m.refs;
+      m.used = ++w->local_map_clock;
+      return i;
+    }
+    if(m.refs == 0 && (victim < 0 || m.used < w->local_maps[victim].used))
+      victim = i;
+  }
+  assert(victim >= 0); // the table has room for one per transaction, and then some
+
+  char local_buf[PATH_MAX];
+  int fd = open(local_name(url_id, local_buf), O_RDONLY);
+  if(fd < 0) {
+    mylog(LOG_ERROR, "error: opening %s", local_buf);
+    return -1;
+  }
+  struct stat st;
+  void *p = MAP_FAILED;
+  if(fstat(fd, &st) == 0 && st.st_size > 0)
+    p = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(p == MAP_FAILED) {
+    mylog(LOG_ERROR, "error: mapping %s", local_buf);
+    return -1;
+  }
+
+  worker_t::local_map_t &m = w->local_maps[victim];
+  if(m.p)
+    munmap((void *)m.p, m.len);
+  m.url_id = url_id;
+  m.p = (const unsigned char *)p;
+  m.len = st.st_size;
+  m.refs = 1;
+  m.used = ++w->local_map_clock;
+  return victim;
+}
+
+void unmap_local(worker_t *w, int slot)
+{
+  --w->local_maps[slot].refs;
+}
+
+// finalize the digest of the transferred content
+void md5_finish(transaction_t &t, unsigned char *md_val)
+{
+  // (once; a burst's request may need it after the md5 check has)
+  if(!t.md5_done) {
+    unsigned int md_len;
+    EVP_DigestFinal_ex(t.mdctx, t.digest, &md_len);
+    t.md5_done = true;
   }
-  do {
-    rv = end - start + 1;
-    if(rv > 102400)
-      rv = 102400;
-    rv = fread(data, 1, rv, f);
-    if(rv == 0)
-      break;
-    EVP_DigestUpdate(&mdctx, data, rv);
-    start += rv;
-  } while(start <= end);
+  memcpy(md_val, t.digest, 16);
+}
 
-  // finalize the digest
-  EVP_DigestFinal_ex(&mdctx, md_val, &md_len);
-  EVP_MD_CTX_cleanup(&mdctx);
+// write whatever we kept of the content to the output file, for
+// looking at later; the file is created here unless --verbose already
+// made one to go with the header and aux files
+void save_content(transaction_t &t)
+{
+  if(opt_save_bytes <= 0 && !t.outfile) {
+    // nothing was kept, so no file; the error line says so instead
+    strcpy(t.outfile_name, "(content not kept; see --save-bytes)");
+    return;
+  }
+  if(!t.outfile) {
+    strcpy(t.outfile_name, "/tmp/testfile.XXXXXX");
+    int fd = mkstemp(t.outfile_name);
+    if(fd < 0 || !(t.outfile = fdopen(fd, "w+b"))) {
+      mylog(LOG_ERROR, "error: opening %s", t.outfile_name);
+      return;
+    }
+  }
 
-  // output
-  md5.reserve(64);
-  char digit[4];
-  for(unsigned int i = 0; i < md_len; ++i) {
-    sprintf(digit, "%02x", md_val[i]);
-    md5.append(digit);
+  if(opt_save_bytes <= 0)
+    return;
+  size_t n = t.bytes_sent, pos = 0;
+  if(n > (size_t)opt_save_bytes) { // the ring wrapped; oldest byte is at pos
+    n = opt_save_bytes;
+    pos = t.bytes_sent % opt_save_bytes;
   }
+  fwrite(t.saved + pos, 1, n - pos, t.outfile);
+  fwrite(t.saved, 1, pos, t.outfile);
 }
 
 void write_auxiliary_stats(const transaction_t &t, const char *ip)
@@ -385,31 +1104,92 @@ void write_auxiliary_stats(const transaction_t &t, const char *ip)
   fprintf(t.outfile_aux, "CURL HANDLE ADDRESS: 0x%p\n", (void *)t.curl);
 }
 
-void finish_transaction(CURL *handle, int result)
+// a transaction in a burst is done: compare its response with the
+// first good one, and sum the burst up after the last.  phase is the
+// time of each phase from its own start, in microseconds.
+void burst_done(worker_t *w, transaction_t *t, int result, long code, const uint64_t *phase)
+{
+  worker_t::burst_t &b = w->bursts[t->burst];
+  if(result != 0)
+    ++b.errors;
+  else {
+    unsigned char d[EVP_MAX_MD_SIZE];
+    if(!opt_no_checks)
+      md5_finish(*t, d);
+    uint64_t first_byte = t->started + phase[LAT_FIRST_BYTE] * 1000, done = t->started + phase[LAT_TOTAL] * 1000;
+    if(b.ok++ == 0) {
+      b.status = code;
+      b.bytes = t->bytes_sent;
+      if(!opt_no_checks)
+        memcpy(b.digest, d, 16);
+      b.first_byte[0] = b.first_byte[1] = first_byte;
+      b.done[0] = b.done[1] = done;
+    } else {
+      if(code != b.status || t->bytes_sent != b.bytes || (!opt_no_checks && memcmp(d, b.digest, 16)))
+        ++b.differ;
+      b.first_byte[0] = std::min(b.first_byte[0], first_byte);
+      b.first_byte[1] = std::max(b.first_byte[1], first_byte);
+      b.done[0] = std::min(b.done[0], done);
+      b.done[1] = std::max(b.done[1], done);
+    }
+    if(t->cache_verdict == CACHE_MISS)
+      ++b.misses;
+  }
+  if(--b.left > 0)
+    return;
+
+  worker_t::herd_stats_t &h = *w->herd_stats;
+  bump(h.bursts);
+  if(b.differ) {
+    bump(h.inconsistent);
+    mylog(LOG_ERROR, "herd content error: %s --- %d of %d responses differ from the first (status %ld, %lu bytes)",
+          b.url_string, b.differ, b.ok, b.status, (unsigned long)b.bytes);
+  }
+  if(b.errors)
+    bump(h.failed);
+  if(opt_cache_stats && b.ok && b.misses <= 1)
+    bump(h.collapsed);
+  if(b.ok) {
+    h.spread[0].record((b.first_byte[1] - b.first_byte[0]) / 1000);
+    h.spread[1].record((b.done[1] - b.done[0]) / 1000);
+    if(log_enabled(LOG_INFO)) {
+      char misses[32] = "";
+      if(opt_cache_stats)
+        snprintf(misses, sizeof(misses), ", %d cache misses", b.misses);
+      mylog(LOG_INFO, "herd: %s x%d --- first byte %.3f..%.3f ms, done %.3f..%.3f ms, %d errors%s", b.url_string,
+            opt_herd, (b.first_byte[0] - b.started) / 1e6, (b.first_byte[1] - b.started) / 1e6,
+            (b.done[0] - b.started) / 1e6, (b.done[1] - b.started) / 1e6, b.errors, misses);
+    }
+  }
+  w->idle_bursts.push_back(t->burst);
+}
+
+void finish_transaction(worker_t *w, CURL *handle, int result)
 {
+  transaction_t *t;
   bool noremove = false;
+  int verdict = TRACE_UNCHECKED; // for the trace
+  char ip_buf[INET_ADDRSTRLEN];
   const char *ip_address = "unknown address";
 
   assert(handle != NULL);
 
-  // lookup the transaction data, then remove the key from the curl ->
-  // T map
-  std::map<CURL *, std::list<transaction_t>::iterator>::iterator ctTit =
-    curl_to_T.find(handle);
-  assert(ctTit != curl_to_T.end());
-  std::list<transaction_t>::iterator t = ctTit->second;
-  curl_to_T.erase(ctTit);
+  // lookup the transaction data
+  char *priv = 0;
+  curl_easy_getinfo(handle, CURLINFO_PRIVATE, &priv);
+  t = (transaction_t *)priv;
 
-  assert(t->curl != NULL);
-  assert(t != T.end());
+  assert(t != NULL);
+  assert(t->in_use && t->curl == handle);
 
   // try to get the ip address we were connected to
   int sock;
   if(curl_easy_getinfo(handle, CURLINFO_LASTSOCKET, &sock) == CURLE_OK) {
     struct sockaddr_in sa;
     socklen_t sa_len = (socklen_t)sizeof(sa);
-    if(getpeername(sock, (struct sockaddr *)&sa, &sa_len) == 0)
-      ip_address = inet_ntoa(sa.sin_addr);
+    if(getpeername(sock, (struct sockaddr *)&sa, &sa_len) == 0 &&
+       inet_ntop(AF_INET, &sa.sin_addr, ip_buf, sizeof(ip_buf)))
+      ip_address = ip_buf;
   }
 
   if(opt_verbose) {
@@ -417,113 +1197,205 @@ void finish_transaction(CURL *handle, int result)
     write_auxiliary_stats(*t, ip_address);
   }
 
+  // how long each phase of the transfer took (in microseconds), and
+  // how late it started
+  static const CURLINFO phase_info[LAT_PHASES] = {
+    CURLINFO_NAMELOOKUP_TIME, CURLINFO_CONNECT_TIME, CURLINFO_STARTTRANSFER_TIME, CURLINFO_TOTAL_TIME
+  };
+  uint64_t phase[LAT_PHASES];
+  for(int i = 0; i < LAT_PHASES; ++i) {
+    double d = 0.0;
+    curl_easy_getinfo(handle, phase_info[i], &d);
+    phase[i] = uint64_t(d * 1000000.0);
+  }
+  uint64_t behind = (t->started - t->intended) / 1000;
+
+  // record them for a completed transfer; in --rate mode, count any
+  // time spent waiting for a free slot too, which is what a client
+  // arriving on schedule would have seen
+  if(result == 0 && t->random_terminate_time >= 0) {
+    for(int i = 0; i < LAT_PHASES; ++i)
+      w->latency[i].record(phase[i] + behind);
+    if(w->server_stats && t->server_id >= 0)
+      w->server_stats[t->server_id].latency.record(phase[LAT_TOTAL] + behind);
+  }
+  long code = 0;
+  curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &code);
+
   // remove this transaction from the set being serviced by curl
-  if(!t->currently_throttling && curl_multi_remove_handle(curl, handle) != CURLM_OK) {
-    mylog("error: curl_multi_remove_handle");
+  if(curl_multi_remove_handle(w->curl, handle) != CURLM_OK) {
+    mylog(LOG_ERROR, "error: curl_multi_remove_handle");
     exit(1);
   }
-  curl_easy_cleanup(handle);
-  if(t->headers)
-    curl_slist_free_all(t->headers);
+  release_handle(w, handle);
 
   if(result != 0) { // oops!  an HTTP or connection error!
-    mylog("transfer error: %s [%s] --- %s -> %s", url[t->url_id].c_str(), ip_address,
+    if(!opt_no_checks)
+      save_content(*t);
+    mylog(LOG_ERROR, "transfer error: %s [%s] --- %s -> %s", url_name(t->url_id), ip_address,
           t->error, t->outfile_name);
     noremove = true;
+    verdict = TRACE_TRANSFER_ERROR;
     goto cleanup;
   }
 
-  // if we're doing no consistency checks, don't try to close any
-  // output files since everything is just going to /dev/null anyway
-  if(!opt_no_checks)
-    noremove = true;
-
   // consistency checking
 
   if(!opt_no_checks) {
 
-    fflush(t->outfile);
-    struct stat st;
-    if(fstat(fileno(t->outfile), &st) < 0)
-      mylog("error: fstat on %s", t->outfile);
-
-    if(!t->byterange_end && t->random_terminate_time >= 0 && md5_size == url_size) {
-      // full transfer?  if we have md5s, check against that
-      std::string xfer_md5;
-      md5_compute(t->outfile, 0, st.st_size-1, xfer_md5);
-      if(strcmp(xfer_md5.c_str(), md5[t->url_id].c_str())) {
-        mylog("full-file md5 error: %s [%s] --- %s (truth) != %s (%d transferred bytes) -> %s",
-              url[t->url_id].c_str(), ip_address, md5[t->url_id].c_str(), xfer_md5.c_str(),
-              st.st_size, t->outfile_name);
+    size_t xfer_size = t->bytes_sent;
+
+    if(t->truth >= 0 || t->synthetic) {
+      // we have the local file, or it's a synthetic object: the
+      // content has already been compared with the truth as it
+      // arrived, so just look at what that found.  that works just as
+      // well for the part of a transfer we terminated early.  (the
+      // size of a synthetic object is only known if there's a size
+      // list.)
+      bool partial = t->random_terminate_time < 0;
+      int64_t whole = t->truth >= 0 ? (int64_t)w->local_maps[t->truth].len :
+        have_object_sizes() ? url_object_size(t->url_id) : -1;
+      int64_t expected = t->byterange_end && !t->whole_file ?
+        t->byterange_end - t->byterange_start + 1 : whole;
+      const char *kind = t->byterange_end ? "byte-range" : "full-file";
+      char range[64] = "";
+      if(t->byterange_end)
+        snprintf(range, sizeof(range), ", range %d-%d", t->byterange_start, t->byterange_end);
+      const char *cut = partial ? ", terminated early" : "";
+
+      if(t->mismatch_at) {
+        save_content(*t);
+        mylog(LOG_ERROR, "%s content error: %s [%s] --- differs from the %s at byte %lu (%lu transferred bytes%s%s)%s -> %s",
+              kind, url_name(t->url_id), ip_address, t->synthetic ? "synthetic object" : "local copy",
+              (unsigned long)(t->mismatch_at - 1), xfer_size,
+              t->byterange_end && t->whole_file ? " of the whole file" : "", cut, range, t->outfile_name);
         noremove = true;
+        verdict = TRACE_CONTENT_ERROR;
         goto cleanup;
       }
-    } else if(t->byterange_end && t->random_terminate_time >= 0 && local_size == url_size) {
-      // byte range request?  if we have local files, compare the bytes
-      std::string xfer_md5, local_md5;
-      md5_compute(t->outfile, 0, st.st_size-1, xfer_md5);
-      FILE *lf = fopen(local[t->url_id].c_str(), "rb");
-      if(!lf) {
-        mylog("error: opening %s", local[t->url_id].c_str());
+
+      // a terminated transfer can be short, but not long
+      if(expected >= 0 && (partial ? xfer_size > (size_t)expected : xfer_size != (size_t)expected)) {
+        save_content(*t);
+        mylog(LOG_ERROR, "%s size mismatch error: %s [%s] --- %lu (truth) != %lu (transferred bytes%s)%s -> %s",
+              kind, url_name(t->url_id), ip_address, (unsigned long)expected, xfer_size,
+              cut, range, t->outfile_name);
+        noremove = true;
+        verdict = TRACE_SIZE_ERROR;
         goto cleanup;
       }
 
-      // first delivery from cache gives the whole file, even if it's
-      // a byte range request, so verify appropriately
-      if(st.st_size > t->byterange_end - t->byterange_start + 1) {
-        struct stat lst;
-        if(fstat(fileno(lf), &lst) < 0)
-          mylog("error: fstat on %s", local[t->url_id].c_str());
-
-        if(lst.st_size == st.st_size) {
-          if(!opt_quiet)
-            mylog("first-download cache byte range exception: %s [%s], range %d-%d, got %d bytes",
-                  url[t->url_id].c_str(), ip_address, t->byterange_start, t->byterange_end, st.st_size);
-          local_md5 = md5[t->url_id];
-        } else {
-          mylog("byte-range size mismatch error: %s [%s] --- %u (truth) != %u (transferred bytes), range %d-%d -> %s",
-                url[t->url_id].c_str(), ip_address, lst.st_size, st.st_size,
-                t->byterange_start, t->byterange_end, t->outfile_name);
-          goto cleanup;
-        }
-      } else
-        md5_compute(lf, t->byterange_start, t->byterange_end, local_md5);
+      verdict = TRACE_OK;
 
-      if(strcmp(xfer_md5.c_str(), local_md5.c_str())) {
-        mylog("byte-range md5 error: %s [%s] --- %s (truth) != %s (%d transferred bytes), range %d-%d -> %s",
-              url[t->url_id].c_str(), ip_address, local_md5.c_str(), xfer_md5.c_str(), st.st_size,
-              t->byterange_start, t->byterange_end, t->outfile_name);
+      // first delivery from cache gives the whole file, even if it's
+      // a byte range request
+      if(t->byterange_end && t->whole_file && log_enabled(LOG_INFO))
+        mylog(LOG_INFO, "first-download cache byte range exception: %s [%s], range %d-%d, got %lu bytes%s",
+              url_name(t->url_id), ip_address, t->byterange_start, t->byterange_end, xfer_size,
+              !opt_cache_stats ? "" : t->cache_verdict == CACHE_MISS ? " (cache miss)" :
+              t->cache_verdict == CACHE_HIT ? " (cache hit)" : " (not classified)");
+    } else if(!t->byterange_end && t->random_terminate_time >= 0 && md5_size == url_size) {
+      // full transfer?  if we have md5s, check against that (there's
+      // nothing to check part of a transfer against, though)
+      unsigned char xfer_md5[EVP_MAX_MD_SIZE];
+      md5_finish(*t, xfer_md5);
+      if(memcmp(xfer_md5, url_md5(t->url_id), 16)) {
+        char truth_hex[33], xfer_hex[33];
+        digest_to_hex(url_md5(t->url_id), truth_hex);
+        digest_to_hex(xfer_md5, xfer_hex);
+        save_content(*t);
+        mylog(LOG_ERROR, "full-file md5 error: %s [%s] --- %s (truth) != %s (%lu transferred bytes) -> %s",
+              url_name(t->url_id), ip_address, truth_hex, xfer_hex,
+              xfer_size, t->outfile_name);
         noremove = true;
-        fclose(lf);
+        verdict = TRACE_MD5_ERROR;
         goto cleanup;
       }
-
-      if(lf)
-        fclose(lf);
+      verdict = TRACE_OK;
     }
 
-    if(!opt_quiet) {
+    if(log_enabled(LOG_INFO)) {
+      const char *cut = t->random_terminate_time < 0 ? " (terminated early)" : "";
       if(t->byterange_end)
-        mylog("success: %s [%s], range %d-%d --- %d bytes", url[t->url_id].c_str(),
-              ip_address, t->byterange_start, t->byterange_end, st.st_size);
+        mylog(LOG_INFO, "success: %s [%s], range %d-%d --- %lu bytes%s", url_name(t->url_id),
+              ip_address, t->byterange_start, t->byterange_end, xfer_size, cut);
       else
-        mylog("success: %s [%s] --- %d bytes", url[t->url_id].c_str(), ip_address, st.st_size);
+        mylog(LOG_INFO, "success: %s [%s] --- %lu bytes%s", url_name(t->url_id), ip_address, xfer_size, cut);
     }
 
   } // !opt_no_checks
 
 
  cleanup:
-  if(t != T.end()) {
+  {
+    if(trace.is_open()) {
+      trace_record r;
+      memset(&r, 0, sizeof(r));
+      r.start = t->started - run_start;
+      r.bytes = t->bytes_sent;
+      r.range_start = t->byterange_start;
+      r.range_end = t->byterange_end;
+      r.url_id = t->url_id;
+      r.server = t->server_id;
+      r.dns = trace_usec(phase[LAT_DNS]);
+      r.connect = trace_usec(phase[LAT_CONNECT]);
+      r.first_byte = trace_usec(phase[LAT_FIRST_BYTE]);
+      r.total = trace_usec(phase[LAT_TOTAL]);
+      r.behind = trace_usec(behind);
+      r.throttle_rate = t->throttle_bytes_per_sec;
+      r.status = code;
+      r.curl_result = result;
+      r.result = verdict;
+      r.flags = (t->random_terminate_time < 0 ? TRACE_TERMINATED : 0) |
+        (t->throttle_bytes_per_sec ? TRACE_THROTTLED : 0) |
+        (t->byterange_end ? TRACE_RANGE : 0) |
+        (t->byterange_end && t->whole_file ? TRACE_WHOLE_FILE : 0) |
+        (t->started - t->intended > 1000000 ? TRACE_LATE : 0) |
+        (t->cache_verdict == CACHE_HIT ? TRACE_CACHE_HIT : 0) |
+        (t->cache_verdict == CACHE_MISS ? TRACE_CACHE_MISS : 0);
+      trace.append(r);
+    }
+
+    bump(w->outcomes.results[verdict]);
+    bump(w->outcomes.statuses[code > 0 && code < 600 ? code : 0]);
+    if(result > 0 && result < CURL_LAST)
+      bump(w->outcomes.curl_errors[result]);
+    if(t->random_terminate_time < 0)
+      bump(w->outcomes.terminated);
+    if(t->throttle_bytes_per_sec)
+      bump(w->outcomes.throttled);
+
+    // every failure the server could be blamed for leaves its content
+    // behind (noremove), so that's what we count as an error
+    if(w->server_stats && t->server_id >= 0) {
+      worker_t::server_stats_t &ss = w->server_stats[t->server_id];
+      bump(ss.requests);
+      bump(ss.bytes, t->bytes_sent);
+      if(noremove)
+        bump(ss.errors);
+    }
+    // cache hits and misses count when the transfer worked, even if
+    // we cut it short; their latency is recorded like w->latency
+    if(w->cache_stats && result == 0) {
+      worker_t::cache_stats_t &cs = w->cache_stats[t->cache_verdict];
+      bump(cs.requests);
+      bump(cs.bytes, t->bytes_sent);
+      if(t->random_terminate_time >= 0)
+        for(int i = 0; i < LAT_PHASES; ++i)
+          cs.latency[i].record(phase[i] + behind);
+    }
+    if(t->truth >= 0)
+      unmap_local(w, t->truth);
     if(t->outfile)
       fclose(t->outfile);
     if(t->outfile_headers)
       fclose(t->outfile_headers);
     if(t->outfile_aux)
       fclose(t->outfile_aux);
-    if(!noremove) {
+    if(!noremove && t->outfile_name[0]) {
       unlink(t->outfile_name);
       if(opt_verbose) {
+        char outfile_extra_name[128];
         strcpy(outfile_extra_name, t->outfile_name);
         strcat(outfile_extra_name, ".header");
         unlink(outfile_extra_name);
@@ -532,7 +1404,17 @@ void finish_transaction(CURL *handle, int result)
         unlink(outfile_extra_name);
       }
     }
-    T.erase(t);
+    if(t->burst >= 0)
+      burst_done(w, t, result, code, phase);
+    // give the slot back
+    w->timers.cancel(timer_id(w, t, TIMER_TERMINATE));
+    w->timers.cancel(timer_id(w, t, TIMER_THROTTLE));
+    if(t->currently_throttling)
+      --w->throttled;
+    if(t->waiting_for_cap)
+      w->cap_waiting.erase(std::find(w->cap_waiting.begin(), w->cap_waiting.end(), int(t - w->slots)));
+    t->reset();
+    w->idle.push_back(t - w->slots);
   }
 }
 
@@ -540,239 +1422,1184 @@ int parse_command_line(int argc, char **argv); // below
 
 void quit(int sig)
 {
-  mylog("received signal %d, quitting", sig);
-  exit(0);
+  quitting = sig;
 }
 
-int main(int argc, char **argv)
+// SIGUSR1 and SIGUSR2 make the log more or less verbose
+void change_log_level(int sig)
 {
-  srand48(time(0));
-  parse_command_line(argc, argv);
-
-  // initialize curl
-  curl = curl_multi_init();
+  int level = log_level + (sig == SIGUSR1 ? 1 : -1);
+  if(level >= LOG_ERROR && level <= LOG_INFO)
+    log_set_level(level);
+}
 
-  // turn on curlm pipelining if opt_reuse is set
-  if(opt_reuse && curl_multi_setopt(curl, CURLMOPT_PIPELINING, 1) != CURLM_OK) {
-    mylog("error: curl_multi_setopt");
-    return 1;
+// add up the workers' latency histograms
+void latency_snapshot(histogram *out)
+{
+  histogram h;
+  for(int p = 0; p < LAT_PHASES; ++p) {
+    out[p].clear();
+    for(int i = 0; i < opt_threads; ++i) {
+      workers[i].latency[p].snapshot(h);
+      out[p].add(h);
+    }
   }
+}
 
-  // set some signal handlers; mainly this is useful to exit normally
-  // (call "exit") on interruption so that profiler data is written
-  // properly for debugging and optimization
-  signal(SIGINT, quit);
-  signal(SIGQUIT, quit);
-  signal(SIGTERM, quit);
-
-  // go go go
-  fd_set rfds, wfds;
-  int rv, max, running = 0;
-  struct timeval tv;
-  time_t last_status = 0;
-  int prev_url = 0;
-  unsigned int done = 0, done_since_last = 0;
-
-  while(1) {
-
-    // maintain the maximum number of simultaneous connections until
-    // we're done with all our transactions
-    while(T.size() < (unsigned int)opt_connections) {
-
-      std::list<transaction_t>::iterator tit = T.insert(T.end(), transaction_t());
-      transaction_t &t = T.back();
-
-      // pick the next URL to hit
-      if(opt_repeat_prob && drand48() < opt_repeat_prob) {
-        // repeat the previous request
-        t.url_id = prev_url;
-        if(!opt_quiet)
-          mylog("opting to repeat request for %s immediately", url[t.url_id].c_str());
-      } else if(opt_random) {
-        // choose a random URL
-        t.url_id = lrand48() % url_size;
-      } else {
-        // choose URLs in sequence
-        t.url_id = cur_url;
-        if((unsigned int)++cur_url >= url_size)
-          cur_url = 0;
-      }
-      prev_url = t.url_id;
-
-      if(!opt_no_checks) {
-        // generate a temporary filename to save the data to, then
-        // open the content, header, and auxiliary data files
-        strcpy(t.outfile_name, "/tmp/testfile.XXXXXX");
-        int fd = mkstemp(t.outfile_name);
-        t.outfile = fdopen(fd, "w+b");
-        if(opt_verbose) {
-          strcpy(outfile_extra_name, t.outfile_name);
-          strcat(outfile_extra_name, ".header");
-          t.outfile_headers = fopen(outfile_extra_name, "w+b");
-          strcpy(outfile_extra_name, t.outfile_name);
-          strcat(outfile_extra_name, ".aux");
-          t.outfile_aux = fopen(outfile_extra_name, "w+b");
-        }
-        if(!t.outfile || (opt_verbose && (!t.outfile_headers || !t.outfile_aux))) {
-          mylog("error: opening %s output set", t.outfile_name);
-          return 1;
-        }
-      }
-
-      // decide whether to make a byte range request
-      if(opt_br_prob && drand48() < opt_br_prob) {
-        struct stat st;
-        if(stat(local[t.url_id].c_str(), &st) < 0)
-          mylog("error: stat on %s", local[t.url_id].c_str());
-        else {
-          // pick random starting/ending bytes
-          t.byterange_start = lrand48() % (st.st_size-1);
-          t.byterange_end = t.byterange_start + 1 + lrand48() % (st.st_size-1-t.byterange_start);
-        }
-      }
+void log_latency(const char *what, const histogram *h)
+{
+  if(h[LAT_TOTAL].count() == 0)
+    return;
+  char buf[LAT_PHASES][128];
+  for(int p = 0; p < LAT_PHASES; ++p)
+    format_latency(h[p], buf[p], sizeof(buf[p]));
+  mylog(LOG_STATUS, "%s: %s %s, %s %s, %s %s, %s %s (p50/p90/p99/p99.9/max ms, %lu transfers)", what,
+        latency_names[LAT_DNS], buf[LAT_DNS], latency_names[LAT_CONNECT], buf[LAT_CONNECT],
+        latency_names[LAT_FIRST_BYTE], buf[LAT_FIRST_BYTE], latency_names[LAT_TOTAL], buf[LAT_TOTAL],
+        (unsigned long)h[LAT_TOTAL].count());
+}
 
-      // decide whether to terminate randomly, and if so, pick a
-      // random wait time after which we'll terminate
-      if(opt_term_prob && drand48() < opt_term_prob) {
-        t.random_terminate_time = opt_term_min_sec +
-          pow(opt_term_weibull_lambda*(-log(drand48())), 1.0/opt_term_weibull_k);
-      }
+// a line per server: requests so far (and their share, next to the
+// share the server's weight asks for), errors so far, and the
+// download rate since the last call, which updates prev_bytes
+// secs is how long it's been since the last call
+void log_server_stats(std::vector<unsigned long> &prev_bytes, double secs)
+{
+  unsigned long total = 0;
+  std::vector<worker_t::server_stats_t> sum(servers.size());
+  for(unsigned int j = 0; j < servers.size(); ++j) {
+    sum[j].requests = sum[j].errors = sum[j].bytes = 0;
+    for(int i = 0; i < opt_threads; ++i) {
+      const worker_t::server_stats_t &ss = workers[i].server_stats[j];
+      sum[j].requests += peek(ss.requests);
+      sum[j].errors += peek(ss.errors);
+      sum[j].bytes += peek(ss.bytes);
+    }
+    total += sum[j].requests;
+  }
+  for(unsigned int j = 0; j < servers.size(); ++j) {
+    mylog(LOG_STATUS, "server %s: %lu requests (%.1f%%, weight %.1f%%), %lu errors, ~%lu Bps download",
+          servers[j].c_str(), sum[j].requests, total ? 100.0 * sum[j].requests / total : 0.0,
+          100.0 * server_weights[j], sum[j].errors, (unsigned long)((sum[j].bytes - prev_bytes[j]) / secs));
+    prev_bytes[j] = sum[j].bytes;
+  }
+}
 
-      // decide whether (and how much) to throttle the connection
-      if(opt_throttle_prob && drand48() < opt_throttle_prob)
-        t.throttle_bytes_per_sec = opt_throttle_min + lrand48() % (opt_throttle_max-opt_throttle_min);
+// the workers' cache counters added up, for the status loop
+struct cache_totals
+{
+  unsigned long requests[CACHE_VERDICTS], bytes[CACHE_VERDICTS];
+  histogram latency[CACHE_VERDICTS][LAT_PHASES];
 
-      t.start = time(0);
+  void snapshot();
+  void subtract(const cache_totals &c);
+};
 
-      // add the transaction
-      setup_transaction(t);
-      if(curl_multi_add_handle(curl, t.curl) != CURLM_OK) {
-        mylog("error: curl_multi_add_handle");
-        return 1;
+void cache_totals::snapshot()
+{
+  histogram h;
+  for(int v = 0; v < CACHE_VERDICTS; ++v) {
+    requests[v] = bytes[v] = 0;
+    for(int p = 0; p < LAT_PHASES; ++p)
+      latency[v][p].clear();
+    for(int i = 0; i < opt_threads; ++i) {
+      const worker_t::cache_stats_t &cs = workers[i].cache_stats[v];
+      requests[v] += peek(cs.requests);
+      bytes[v] += peek(cs.bytes);
+      for(int p = 0; p < LAT_PHASES; ++p) {
+        cs.latency[p].snapshot(h);
+        latency[v][p].add(h);
       }
+    }
+  }
+}
 
-      // update the curl -> T map
-      curl_to_T[t.curl] = tit;
+void cache_totals::subtract(const cache_totals &c)
+{
+  for(int v = 0; v < CACHE_VERDICTS; ++v) {
+    requests[v] -= c.requests[v];
+    bytes[v] -= c.bytes[v];
+    for(int p = 0; p < LAT_PHASES; ++p)
+      latency[v][p].subtract(c.latency[v][p]);
+  }
+}
+
+// hits and misses, the hit ratio of the requests the rules could
+// classify (and of their bytes), and the latency of hits and misses
+void log_cache_stats(const cache_totals &c, bool summary)
+{
+  unsigned long hits = c.requests[CACHE_HIT], misses = c.requests[CACHE_MISS];
+  unsigned long hit_bytes = c.bytes[CACHE_HIT], miss_bytes = c.bytes[CACHE_MISS];
+  mylog(LOG_STATUS, "cache%s: %lu hits, %lu misses, %lu unclassified, %.1f%% hit ratio, %.1f%% byte hit ratio",
+        summary ? " summary" : "", hits, misses, c.requests[CACHE_UNKNOWN],
+        hits + misses ? 100.0 * hits / (hits + misses) : 0.0,
+        hit_bytes + miss_bytes ? 100.0 * hit_bytes / (hit_bytes + miss_bytes) : 0.0);
+  log_latency(summary ? "hit latency summary" : "hit latency", c.latency[CACHE_HIT]);
+  log_latency(summary ? "miss latency summary" : "miss latency", c.latency[CACHE_MISS]);
+}
+
+// the workers' herd counters added up, likewise
+struct herd_totals
+{
+  unsigned long bursts, inconsistent, failed, collapsed;
+  histogram spread[2];
+
+  void snapshot();
+  void subtract(const herd_totals &h);
+};
+
+void herd_totals::snapshot()
+{
+  histogram h;
+  bursts = inconsistent = failed = collapsed = 0;
+  spread[0].clear();
+  spread[1].clear();
+  for(int i = 0; i < opt_threads; ++i) {
+    const worker_t::herd_stats_t &hs = *workers[i].herd_stats;
+    bursts += peek(hs.bursts);
+    inconsistent += peek(hs.inconsistent);
+    failed += peek(hs.failed);
+    collapsed += peek(hs.collapsed);
+    for(int j = 0; j < 2; ++j) {
+      hs.spread[j].snapshot(h);
+      spread[j].add(h);
     }
+  }
+}
 
-    // select on current transactions
-    FD_ZERO(&rfds);
-    FD_ZERO(&wfds);
-    max = -1;
-    if(curl_multi_fdset(curl, &rfds, &wfds, 0, &max) != CURLM_OK) {
-      mylog("error: curl_multi_fdset");
-      return 1;
+void herd_totals::subtract(const herd_totals &h)
+{
+  bursts -= h.bursts;
+  inconsistent -= h.inconsistent;
+  failed -= h.failed;
+  collapsed -= h.collapsed;
+  spread[0].subtract(h.spread[0]);
+  spread[1].subtract(h.spread[1]);
+}
+
+// bursts finished, how many had responses that differed or failed
+// (and with --cache-stats, were answered with at most one miss), and
+// the spread of first byte and completion times within a burst
+void log_herd_stats(const herd_totals &h, bool summary)
+{
+  char collapsed[64] = "", first_byte[128], done[128];
+  if(opt_cache_stats)
+    snprintf(collapsed, sizeof(collapsed), ", %lu with at most one cache miss", h.collapsed);
+  format_latency(h.spread[0], first_byte, sizeof(first_byte));
+  format_latency(h.spread[1], done, sizeof(done));
+  mylog(LOG_STATUS, "herd%s: %lu bursts of %d, %lu inconsistent, %lu with errors%s; spread within a burst: "
+        "first byte %s, done %s (p50/p90/p99/p99.9/max ms)", summary ? " summary" : "", h.bursts, opt_herd,
+        h.inconsistent, h.failed, collapsed, first_byte, done);
+}
+
+// append to the metrics page
+void metric(std::string &page, const char *fmt, ...)
+{
+  char line[1024];
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(line, sizeof(line), fmt, args);
+  va_end(args);
+  page += line;
+}
+
+// a latency histogram (in microseconds) as a Prometheus histogram in
+// seconds, on a fixed set of buckets; labels is "" or 'name="value",'
+void metric_histogram(std::string &page, const char *name, const char *labels, const histogram &h)
+{
+  static const double bounds[] = { .001, .0025, .005, .01, .025, .05, .1, .25, .5, 1, 2.5, 5, 10, 30, 60 };
+  for(unsigned int i = 0; i < sizeof(bounds) / sizeof(bounds[0]); ++i)
+    metric(page, "%s_bucket{%sle=\"%g\"} %lu\n", name, labels, bounds[i],
+           (unsigned long)h.count_at_most(uint64_t(bounds[i] * 1e6)));
+  metric(page, "%s_bucket{%sle=\"+Inf\"} %lu\n", name, labels, (unsigned long)h.count());
+  std::string l(labels);
+  if(l.length())
+    l = "{" + l.substr(0, l.length() - 1) + "}";
+  metric(page, "%s_sum%s %.6f\n", name, l.c_str(), h.sum / 1e6);
+  metric(page, "%s_count%s %lu\n", name, l.c_str(), (unsigned long)h.count());
+}
+
+// the metrics page, in the Prometheus text format: everything the
+// status lines have, and more, as running totals since the start
+void render_metrics(std::string &page)
+{
+  unsigned long done = 0, bytes = 0, transactions = 0, limit = 0, throttling = 0, late = 0;
+  unsigned long terminated = 0, throttled = 0, results[TRACE_RESULTS] = { 0 };
+  std::vector<unsigned long> curl_errors(CURL_LAST), statuses(600);
+  for(int i = 0; i < opt_threads; ++i) {
+    worker_t &w = workers[i];
+    done += peek(w.stats.done);
+    bytes += peek(w.stats.bytes);
+    transactions += peek(w.stats.transactions);
+    limit += peek(w.limit);
+    throttling += peek(w.stats.throttling);
+    late += peek(w.stats.late);
+    terminated += peek(w.outcomes.terminated);
+    throttled += peek(w.outcomes.throttled);
+    for(int j = 0; j < TRACE_RESULTS; ++j)
+      results[j] += peek(w.outcomes.results[j]);
+    for(int j = 0; j < CURL_LAST; ++j)
+      curl_errors[j] += peek(w.outcomes.curl_errors[j]);
+    for(int j = 0; j < 600; ++j)
+      statuses[j] += peek(w.outcomes.statuses[j]);
+  }
+
+  page.reserve(16384);
+  metric(page, "# TYPE testclient_requests_total counter\ntestclient_requests_total %lu\n", done);
+  metric(page, "# TYPE testclient_bytes_total counter\ntestclient_bytes_total %lu\n", bytes);
+  metric(page, "# TYPE testclient_in_flight gauge\ntestclient_in_flight %lu\n", transactions);
+  metric(page, "# TYPE testclient_transaction_limit gauge\ntestclient_transaction_limit %lu\n", limit);
+  metric(page, "# TYPE testclient_throttling gauge\ntestclient_throttling %lu\n", throttling);
+  metric(page, "# TYPE testclient_throttled_total counter\ntestclient_throttled_total %lu\n", throttled);
+  metric(page, "# TYPE testclient_terminated_total counter\ntestclient_terminated_total %lu\n", terminated);
+  metric(page, "# TYPE testclient_started_late_total counter\ntestclient_started_late_total %lu\n", late);
+
+  static const char *result_names[TRACE_RESULTS] = {
+    "unchecked", "ok", "transfer_error", "content_error", "size_error", "md5_error"
+  };
+  metric(page, "# TYPE testclient_checks_total counter\n");
+  for(int j = 0; j < TRACE_RESULTS; ++j)
+    metric(page, "testclient_checks_total{result=\"%s\"} %lu\n", result_names[j], results[j]);
+  metric(page, "# TYPE testclient_curl_errors_total counter\n");
+  for(int j = 1; j < CURL_LAST; ++j)
+    if(curl_errors[j])
+      metric(page, "testclient_curl_errors_total{code=\"%d\"} %lu\n", j, curl_errors[j]);
+  metric(page, "# TYPE testclient_http_responses_total counter\n");
+  for(int j = 0; j < 600; ++j)
+    if(statuses[j])
+      metric(page, "testclient_http_responses_total{status=\"%d\"} %lu\n", j, statuses[j]);
+
+  histogram lat[LAT_PHASES];
+  latency_snapshot(lat);
+  static const char *phase_labels[LAT_PHASES] = {
+    "phase=\"dns\",", "phase=\"connect\",", "phase=\"first_byte\",", "phase=\"total\","
+  };
+  metric(page, "# TYPE testclient_latency_seconds histogram\n");
+  for(int p = 0; p < LAT_PHASES; ++p)
+    metric_histogram(page, "testclient_latency_seconds", phase_labels[p], lat[p]);
+
+  if(opt_cache_stats) {
+    cache_totals *c = new cache_totals;
+    c->snapshot();
+    metric(page, "# TYPE testclient_cache_requests_total counter\n");
+    for(int v = 0; v < CACHE_VERDICTS; ++v)
+      metric(page, "testclient_cache_requests_total{result=\"%s\"} %lu\n", cache_verdict_names[v], c->requests[v]);
+    metric(page, "# TYPE testclient_cache_bytes_total counter\n");
+    for(int v = 0; v < CACHE_VERDICTS; ++v)
+      metric(page, "testclient_cache_bytes_total{result=\"%s\"} %lu\n", cache_verdict_names[v], c->bytes[v]);
+    metric(page, "# TYPE testclient_cache_latency_seconds histogram\n");
+    for(int v = 0; v < CACHE_VERDICTS; ++v)
+      for(int p = 0; p < LAT_PHASES; ++p) {
+        std::string labels = "result=\"" + std::string(cache_verdict_names[v]) + "\"," + phase_labels[p];
+        metric_histogram(page, "testclient_cache_latency_seconds", labels.c_str(), c->latency[v][p]);
+      }
+    delete c;
+  }
+
+  if(opt_herd) {
+    herd_totals *h = new herd_totals;
+    h->snapshot();
+    metric(page, "# TYPE testclient_herd_bursts_total counter\ntestclient_herd_bursts_total %lu\n", h->bursts);
+    metric(page, "# TYPE testclient_herd_inconsistent_total counter\ntestclient_herd_inconsistent_total %lu\n",
+           h->inconsistent);
+    metric(page, "# TYPE testclient_herd_failed_total counter\ntestclient_herd_failed_total %lu\n", h->failed);
+    if(opt_cache_stats)
+      metric(page, "# TYPE testclient_herd_collapsed_total counter\ntestclient_herd_collapsed_total %lu\n",
+             h->collapsed);
+    metric(page, "# TYPE testclient_herd_spread_seconds histogram\n");
+    metric_histogram(page, "testclient_herd_spread_seconds", "phase=\"first_byte\",", h->spread[0]);
+    metric_histogram(page, "testclient_herd_spread_seconds", "phase=\"total\",", h->spread[1]);
+    delete h;
+  }
+
+  if(!workers[0].server_stats)
+    return;
+  std::vector<unsigned long> requests(servers.size()), errors(servers.size()), sbytes(servers.size());
+  std::vector<histogram> slat(servers.size());
+  histogram h;
+  for(unsigned int j = 0; j < servers.size(); ++j)
+    for(int i = 0; i < opt_threads; ++i) {
+      const worker_t::server_stats_t &ss = workers[i].server_stats[j];
+      requests[j] += peek(ss.requests);
+      errors[j] += peek(ss.errors);
+      sbytes[j] += peek(ss.bytes);
+      ss.latency.snapshot(h);
+      slat[j].add(h);
+    }
+  // server names come from the server list, so they don't need escaping
+  // beyond what a host name or address can hold
+  metric(page, "# TYPE testclient_server_requests_total counter\n");
+  for(unsigned int j = 0; j < servers.size(); ++j)
+    metric(page, "testclient_server_requests_total{server=\"%s\"} %lu\n", servers[j].c_str(), requests[j]);
+  metric(page, "# TYPE testclient_server_errors_total counter\n");
+  for(unsigned int j = 0; j < servers.size(); ++j)
+    metric(page, "testclient_server_errors_total{server=\"%s\"} %lu\n", servers[j].c_str(), errors[j]);
+  metric(page, "# TYPE testclient_server_bytes_total counter\n");
+  for(unsigned int j = 0; j < servers.size(); ++j)
+    metric(page, "testclient_server_bytes_total{server=\"%s\"} %lu\n", servers[j].c_str(), sbytes[j]);
+  metric(page, "# TYPE testclient_server_latency_seconds histogram\n");
+  for(unsigned int j = 0; j < servers.size(); ++j) {
+    std::string labels = "server=\"" + servers[j] + "\",";
+    metric_histogram(page, "testclient_server_latency_seconds", labels.c_str(), slat[j]);
+  }
+}
+
+// with --adapt, the main thread looks for the most simultaneous
+// transactions the servers can take without the p99 time to first
+// byte or the error rate going over their ceilings: starting from one
+// per worker, it doubles the limit every status interval until the
+// first interval over a ceiling (or -n), then adds one per worker for
+// every interval within them and cuts it by a quarter for every one
+// over (AIMD).  the intervals within the ceilings after that are what
+// the run could sustain.
+struct adapt_t
+{
+  adapt_t() : limit(opt_threads), slow_start(true), good_secs(0), good_done(0), good_bytes(0), good_limit(0) {}
+
+  int limit;                // transactions allowed, over all the workers
+  bool slow_start;          // still doubling
+  double good_secs, good_done, good_bytes, good_limit; // totals over the sustainable intervals
+};
+
+// worker i's share of something split evenly between the workers
+inline int share(int total, int i)
+{
+  return total / opt_threads + (i < total % opt_threads ? 1 : 0);
+}
+
+// share a limit between the workers like the slots
+void set_limit(int total)
+{
+  for(int i = 0; i < opt_threads; ++i)
+    gauge(workers[i].limit, share(total, i));
+}
+
+// one step, given what finished in the last status interval (secs long)
+void adapt(adapt_t &a, const histogram &first_byte, unsigned long done, unsigned long bytes,
+           unsigned long errors, double secs)
+{
+  if(done == 0)
+    return; // nothing to go on
+  double p99 = first_byte.percentile(99.0) / 1000.0, error_rate = double(errors) / done;
+  bool over = (opt_adapt_p99 > 0 && p99 > opt_adapt_p99) || error_rate > opt_adapt_error_rate;
+  int prev = a.limit;
+  if(over) {
+    a.slow_start = false;
+    a.limit = int(a.limit * 0.75);
+    if(a.limit < opt_threads) // one per worker, or some would stop
+      a.limit = opt_threads;
+  } else {
+    if(!a.slow_start) {
+      a.good_secs += secs;
+      a.good_done += done;
+      a.good_bytes += bytes;
+      a.good_limit += prev * secs;
+    }
+    a.limit = a.slow_start ? a.limit * 2 : a.limit + opt_threads;
+    if(a.limit >= opt_connections) {
+      a.limit = opt_connections;
+      a.slow_start = false;
+    }
+  }
+  set_limit(a.limit);
+  mylog(LOG_STATUS, "adapt: p99 first byte %.3f ms, %.2f%% errors at %d transactions, %s; now %d",
+        p99, 100.0 * error_rate, prev, over ? "over" : "within", a.limit);
+}
+
+// what the run could sustain, at the end
+void log_adapt_summary(const adapt_t &a)
+{
+  if(a.good_secs == 0) {
+    mylog(LOG_STATUS, "adapt summary: no interval within the limits after the search began");
+    return;
+  }
+  mylog(LOG_STATUS, "adapt summary: sustained ~%lu req per sec, ~%lu Bps at ~%.0f transactions "
+        "(over %.1f seconds within the limits)", (unsigned long)(a.good_done / a.good_secs + 0.5),
+        (unsigned long)(a.good_bytes / a.good_secs + 0.5), a.good_limit / a.good_secs, a.good_secs);
+}
+
+// the gap standing for a rate of 0: practically never, but far
+// enough from overflowing that it can still be added to a time
+const unsigned long no_arrivals = ~0UL >> 2;
+
+// the average time between a worker's arrivals (ns) for its share of
+// a rate
+unsigned long mean_gap(double rate)
+{
+  return rate > 0 ? (unsigned long)(1e9 * opt_threads / rate) : no_arrivals;
+}
+
+void set_rate(double rate)
+{
+  for(int i = 0; i < opt_threads; ++i)
+    gauge(workers[i].arrival_mean, mean_gap(rate));
+}
+
+void use_mix(worker_t *w, const traffic_mix &m)
+{
+  w->mix = m;
+  if(!have_object_sizes()) // nothing to plan a byte range with
+    w->mix.br_prob = 0.0;
+}
+
+// finished requests, bytes and failed requests so far
+void run_totals(unsigned long &done, unsigned long &bytes, unsigned long &errors)
+{
+  done = bytes = errors = 0;
+  for(int i = 0; i < opt_threads; ++i) {
+    done += peek(workers[i].stats.done);
+    bytes += peek(workers[i].stats.bytes);
+    for(int j = TRACE_TRANSFER_ERROR; j < TRACE_RESULTS; ++j)
+      errors += peek(workers[i].outcomes.results[j]);
+  }
+}
+
+// with --profile, the main thread steps through the phases: it sets
+// the workers' limits (or rates) as a phase ramps, tells them when a
+// new phase starts so they pick up its traffic mix, and sums up each
+// phase when it ends
+struct steer_t
+{
+  steer_t() : phase(0), start(0), done(0), bytes(0), errors(0) {}
+
+  size_t phase;             // the phase we're in
+  uint64_t start;           // when it began (ns)
+  unsigned long done, bytes, errors; // the totals then
+  histogram latency[LAT_PHASES];     // ... and the latency histograms
+  std::vector<std::string> summaries; // a line for each phase that's over
+};
+
+void end_phase(steer_t &s, uint64_t end, bool cut)
+{
+  const load_profile::phase_t &p = profile[s.phase];
+  unsigned long done, bytes, errors;
+  run_totals(done, bytes, errors);
+  histogram *cur = new histogram[LAT_PHASES], *lat = new histogram[LAT_PHASES];
+  latency_snapshot(cur);
+  for(int i = 0; i < LAT_PHASES; ++i) {
+    lat[i] = cur[i];
+    lat[i].subtract(s.latency[i]);
+    s.latency[i] = cur[i];
+  }
+
+  double secs = (end - s.start) / 1e9;
+  char level[64], line[512];
+  const char *unit = profile.by_rate() ? "req per sec" : "transactions";
+  if(p.from == p.to)
+    snprintf(level, sizeof(level), "%g %s", p.from, unit);
+  else
+    snprintf(level, sizeof(level), "%g..%g %s", p.from, p.to, unit);
+  snprintf(line, sizeof(line), "%s (%.1f seconds%s, %s): %lu requests, ~%lu req per sec, ~%lu Bps download, "
+           "%lu errors, p50/p99 first byte %.3f/%.3f ms, total %.3f/%.3f ms", p.name.c_str(), secs,
+           cut ? ", cut short" : "", level, done - s.done, (unsigned long)((done - s.done) / secs + 0.5),
+           (unsigned long)((bytes - s.bytes) / secs + 0.5), errors - s.errors,
+           lat[LAT_FIRST_BYTE].percentile(50.0) / 1000.0, lat[LAT_FIRST_BYTE].percentile(99.0) / 1000.0,
+           lat[LAT_TOTAL].percentile(50.0) / 1000.0, lat[LAT_TOTAL].percentile(99.0) / 1000.0);
+  mylog(LOG_STATUS, "phase %s", line);
+  s.summaries.push_back(line);
+  s.done = done;
+  s.bytes = bytes;
+  s.errors = errors;
+  delete [] cur;
+  delete [] lat;
+}
+
+// bring the load up to date; returns when it next needs doing, or
+// sets quitting at the end of the profile.  ramps are followed every
+// 100ms, and a phase starts on time.
+uint64_t steer(steer_t &s, uint64_t now)
+{
+  for(;;) {
+    const load_profile::phase_t &p = profile[s.phase];
+    uint64_t end = s.start + uint64_t(p.secs * 1e9);
+    if(now < end) {
+      double level = p.from + (p.to - p.from) * double(now - s.start) / (end - s.start);
+      if(profile.by_rate())
+        set_rate(level);
+      else
+        set_limit(int(level + 0.5));
+      return p.from != p.to && now + 100000000 < end ? now + 100000000 : end;
+    }
+    end_phase(s, end, false);
+    if(++s.phase == profile.size()) {
+      quitting = -1;
+      return now;
+    }
+    s.start = end;
+    gauge(profile_phase, s.phase);
+    mylog(LOG_STATUS, "phase %s begins", profile[s.phase].name.c_str());
+  }
+}
+
+// sleep until the deadline (on the monotonic clock), answering
+// requests for the metrics page in the meantime if it's served
+void wait_until(metrics_server &metrics, uint64_t deadline)
+{
+  if(opt_metrics_port)
+    metrics.serve_until(deadline, render_metrics, &quitting);
+  else {
+    // only quitting cuts the wait short; SIGUSR1/SIGUSR2 shouldn't
+    // make an early status line (or an --adapt step on part of one)
+    struct timespec ts = { time_t(deadline / 1000000000ULL), long(deadline % 1000000000ULL) };
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0) == EINTR && !quitting)
+      ;
+  }
+}
+
+// choose a random URL according to the popularity model
+unsigned int random_url(worker_t *w)
+{
+  switch(opt_popularity) {
+  case POP_ZIPF:
+  case POP_WEIGHTS:
+    return url_popularity.sample(w->rng);
+  case POP_HOTSET:
+    if(erand48(w->rng) < opt_hot_prob)
+      return nrand48(w->rng) % hot_size;
+    return hot_size + nrand48(w->rng) % (url_size - hot_size);
+  default:
+    return nrand48(w->rng) % url_size;
+  }
+}
+
+// time from one scheduled arrival to the next, in ns, for a worker
+// handling its equal share of the rate
+uint64_t arrival_gap(worker_t *w)
+{
+  double mean = peek(w->arrival_mean);
+  if(mean >= no_arrivals) // none until the rate changes (see steer())
+    return no_arrivals;
+  if(opt_poisson)
+    return uint64_t(-log(1.0 - erand48(w->rng)) * mean);
+  return uint64_t(mean);
+}
+
+// start a new transaction in an idle slot; intended is when it was
+// scheduled to start (in --rate mode; otherwise 0, meaning now).  a
+// request in a burst (see start_burst()) is a plain GET for the
+// burst's URL: no byte range, throttling or early termination.
+void start_transaction(worker_t *w, uint64_t intended, int burst)
+{
+  transaction_t &t = w->slots[w->idle.back()];
+  w->idle.pop_back();
+  t.in_use = true;
+  t.burst = burst;
+
+  // pick the next URL to hit
+  if(burst >= 0)
+    t.url_id = w->bursts[burst].url_id;
+  else if(w->mix.repeat_prob && erand48(w->rng) < w->mix.repeat_prob) {
+    // repeat the previous request
+    t.url_id = w->prev_url;
+    if(log_enabled(LOG_INFO))
+      mylog(LOG_INFO, "opting to repeat request for %s immediately", url_name(t.url_id));
+  } else if(opt_random) {
+    // choose a random URL
+    t.url_id = random_url(w);
+  } else {
+    // choose URLs in sequence
+    t.url_id = w->cur_url;
+    if((unsigned int)++w->cur_url >= url_size)
+      w->cur_url = 0;
+  }
+  w->prev_url = t.url_id;
+
+  if(opt_verbose) {
+    // generate a temporary filename to save the data to if the
+    // request fails, then open the header and auxiliary data
+    // files to go with it
+    strcpy(t.outfile_name, "/tmp/testfile.XXXXXX");
+    int fd = mkstemp(t.outfile_name);
+    t.outfile = fdopen(fd, "w+b");
+    {
+      char outfile_extra_name[128];
+      strcpy(outfile_extra_name, t.outfile_name);
+      strcat(outfile_extra_name, ".header");
+      t.outfile_headers = fopen(outfile_extra_name, "w+b");
+      strcpy(outfile_extra_name, t.outfile_name);
+      strcat(outfile_extra_name, ".aux");
+      t.outfile_aux = fopen(outfile_extra_name, "w+b");
+    }
+    if(!t.outfile || !t.outfile_headers || !t.outfile_aux) {
+      mylog(LOG_ERROR, "error: opening %s output set", t.outfile_name);
+      exit(1);
+    }
+  }
+
+  // decide whether to make a byte range request
+  if(burst < 0 && w->mix.br_prob && erand48(w->rng) < w->mix.br_prob) {
+    // the local files' sizes were found at startup (or compiled into
+    // the workload), so this doesn't touch the filesystem
+    int64_t size = url_object_size(t.url_id);
+    if(size > 1) {
+      // pick random starting/ending bytes
+      t.byterange_start = nrand48(w->rng) % (size-1);
+      t.byterange_end = t.byterange_start + 1 + nrand48(w->rng) % (size-1-t.byterange_start);
+    }
+  }
+
+  if(!opt_no_checks) {
+    // synthetic objects and local files are compared with the truth
+    // as they arrive, so even a transfer cut short can be checked;
+    // otherwise the content is hashed as it arrives.  only the tail
+    // is kept, in memory.
+    if(opt_synthetic) {
+      line_t path = object_path(t.url_id);
+      t.synthetic = true;
+      t.synthetic_key = synthetic_key(opt_synthetic_key, path.p, path.len);
+    } else if(local_size == url_size &&
+              (!have_object_sizes() || url_object_size(t.url_id) > 0))
+      // a file that was missing (or empty) at startup was reported
+      // then; it falls back to the md5 list, not an error per request
+      t.truth = local_map(w, t.url_id);
+    if((t.truth < 0 && !t.synthetic) || burst >= 0)
+      EVP_DigestInit_ex(t.mdctx, EVP_md5(), NULL);
+  }
+
+  // decide whether to terminate randomly, and if so, pick a
+  // random wait time after which we'll terminate
+  if(burst < 0 && w->mix.term_prob && erand48(w->rng) < w->mix.term_prob) {
+    t.random_terminate_time = opt_term_min_sec +
+      pow(opt_term_weibull_lambda*(-log(erand48(w->rng))), 1.0/opt_term_weibull_k);
+  }
+
+  // decide whether (and how much) to throttle the connection
+  if(burst < 0 && w->mix.throttle_prob && erand48(w->rng) < w->mix.throttle_prob)
+    t.throttle_bytes_per_sec = opt_throttle_min +
+      (opt_throttle_max > opt_throttle_min ? nrand48(w->rng) % (opt_throttle_max - opt_throttle_min + 1) : 0);
+
+  t.started = now_nsec();
+  t.intended = intended ? intended : t.started;
+  if(t.started - t.intended > 1000000) // more than a millisecond behind schedule
+    bump(w->stats.late);
+
+  // the default --term-min-sec (1e11) means never; a deadline that
+  // far out doesn't fit in a uint64 of ns, so it gets no timer
+  if(t.random_terminate_time > 0 && t.random_terminate_time < 1e9)
+    w->timers.set(timer_id(w, &t, TIMER_TERMINATE),
+                  t.started + uint64_t(t.random_terminate_time * 1e9));
+  if(t.throttle_bytes_per_sec)
+    t.shaper.start(t.throttle_bytes_per_sec, t.started);
+
+  // add the transaction
+  setup_transaction(t);
+  if(curl_multi_add_handle(w->curl, t.curl) != CURLM_OK) {
+    mylog(LOG_ERROR, "error: curl_multi_add_handle");
+    exit(1);
+  }
+}
+
+// the next URL in this worker's share of the list; none of them have
+// been asked for before, until we've been through them all
+unsigned int cold_url(worker_t *w)
+{
+  unsigned int end = (unsigned long)url_size * (w->id + 1) / opt_threads;
+  if((unsigned int)w->cur_url >= end) {
+    if(!w->herd_wrapped)
+      mylog(LOG_WARNING, "warning: thread %d has been through its share of the URLs; from now on they're "
+            "only cold if they get a query string (--random-qstring-prob)", w->id);
+    w->herd_wrapped = true;
+    w->cur_url = (unsigned long)url_size * w->id / opt_threads;
+  }
+  return w->cur_url++;
+}
+
+// start a burst of --herd requests for a cold URL in an idle burst
+// slot; they all go to the same server, in the same pass of the
+// event loop
+void start_burst(worker_t *w)
+{
+  int i = w->idle_bursts.back();
+  w->idle_bursts.pop_back();
+  worker_t::burst_t &b = w->bursts[i];
+  b.url_id = cold_url(w);
+  ++w->herd_count;
+  b.server_id = generate_url(w, b.url_id, b.url_string);
+  b.started = now_nsec();
+  b.left = opt_herd;
+  b.ok = b.errors = b.differ = b.misses = 0;
+  for(int k = 0; k < opt_herd; ++k)
+    start_transaction(w, 0, i);
+}
+
+// a worker's event loop: keep its share of the transactions going
+// until we're asked to quit
+void * run_worker(void *arg)
+{
+  worker_t *w = (worker_t *)arg;
+
+  w->curl = curl_multi_init();
+  if(!w->curl) {
+    mylog(LOG_ERROR, "error: curl_multi_init");
+    exit(1);
+  }
+
+  // turn on curlm pipelining if opt_reuse is set
+  if(opt_reuse && curl_multi_setopt(w->curl, CURLMOPT_PIPELINING, 1) != CURLM_OK) {
+    mylog(LOG_ERROR, "error: curl_multi_setopt");
+    exit(1);
+  }
+
+  // drive curl from epoll: curl tells us which sockets to watch and
+  // when it needs a timeout, and we only hand it sockets that are
+  // ready
+  w->epfd = epoll_create(1024);
+  if(w->epfd < 0) {
+    mylog(LOG_ERROR, "error: epoll_create (%d)", errno);
+    exit(1);
+  }
+  if(curl_multi_setopt(w->curl, CURLMOPT_SOCKETFUNCTION, socket_callback) != CURLM_OK ||
+     curl_multi_setopt(w->curl, CURLMOPT_SOCKETDATA, w) != CURLM_OK ||
+     curl_multi_setopt(w->curl, CURLMOPT_TIMERFUNCTION, timer_callback) != CURLM_OK ||
+     curl_multi_setopt(w->curl, CURLMOPT_TIMERDATA, w) != CURLM_OK) {
+    mylog(LOG_ERROR, "error: curl_multi_setopt");
+    exit(1);
+  }
+
+  // set up the transaction table, all idle, with no timers set
+  w->slots = new transaction_t[w->connections];
+  w->timers.init(w->connections * TIMERS_PER_SLOT + 1);
+  if(opt_max_bandwidth)
+    w->cap.start(opt_max_bandwidth / opt_threads, now_nsec());
+  w->idle.reserve(w->connections);
+  for(int i = w->connections - 1; i >= 0; --i) {
+    w->slots[i].init(w);
+    w->idle.push_back(i);
+  }
+
+  // fill the easy handle pool up front, one handle per transaction
+  w->template_handle = make_template_handle();
+  w->handles.reserve(w->connections);
+  for(int i = 0; i < w->connections; ++i) {
+    CURL *c = curl_easy_duphandle(w->template_handle);
+    if(c == NULL) {
+      mylog(LOG_ERROR, "error: curl_easy_duphandle");
+      exit(1);
+    }
+    w->handles.push_back(c);
+  }
+
+  // with --herd, as many bursts as there are slots for
+  if(opt_herd) {
+    w->bursts.resize(w->connections / opt_herd);
+    for(int i = w->bursts.size() - 1; i >= 0; --i) {
+      w->bursts[i].url_string = new char[url_string_size];
+      w->idle_bursts.push_back(i);
+    }
+  }
+
+  // regexec locks each compiled rule, so rather than share them, each
+  // thread matches the response headers with its own
+  if(opt_cache_stats) {
+    w->cache_rule_copy = new cache_rules;
+    w->cache_rule_copy->copy(cache_rule_set);
+  }
+
+  // no local files mapped yet; there's room for every transaction to
+  // be using one, plus the idle ones we keep
+  worker_t::local_map_t none = { -1, 0, 0, 0, 0 };
+  w->local_maps.assign(local_size == url_size ? w->connections + opt_local_files : 0, none);
+
+  // spread the workers' first arrivals over one gap so their
+  // schedules interleave
+  if(opt_rate > 0)
+    w->next_arrival = now_nsec() + arrival_gap(w) * w->id / opt_threads;
+
+  // go go go
+  const int max_events = 1024;
+  struct epoll_event events[max_events];
+  int rv, nev, running = 0;
+
+  while(!quitting) {
+
+    // a new phase of the profile brings its own traffic mix
+    if(!profile.empty() && peek(profile_phase) != w->phase) {
+      w->phase = peek(profile_phase);
+      use_mix(w, profile[w->phase].mix);
     }
-    tv.tv_sec = 1;
-    tv.tv_usec = 0;
-    if(max < 0) max = 0;
-    rv = select(max + 1, &rfds, &wfds, 0, &tv);
-    if(rv < 0) {
+
+    if(opt_rate > 0) {
+      // open loop: start whatever is due according to the schedule,
+      // as far as the free slots allow; anything we can't start yet
+      // keeps its scheduled time, so the delay counts against it.  if
+      // the rate has gone up, the next arrival shouldn't have to wait
+      // out a gap at the old one.
+      uint64_t now = now_nsec();
+      unsigned long gap = peek(w->arrival_mean);
+      if(gap < w->gap_seen && w->next_arrival > now + gap)
+        w->next_arrival = now + arrival_gap(w);
+      w->gap_seen = gap;
+      while(!w->idle.empty() && w->next_arrival <= now) {
+        start_transaction(w, w->next_arrival, -1);
+        w->next_arrival += arrival_gap(w);
+      }
+    } else {
+      // closed loop: maintain the maximum number of simultaneous
+      // connections, or as many as --adapt allows for now; when that
+      // drops, the excess just finishes without being replaced.  with
+      // --herd, they go in whole bursts, the limit rounded up to one
+      // (so a profile's share of less than a burst still runs one).
+      unsigned long limit = peek(w->limit);
+      if(opt_herd) {
+        limit = (limit + opt_herd - 1) / opt_herd * opt_herd;
+        while(!w->idle_bursts.empty() && w->connections - w->idle.size() + opt_herd <= limit)
+          start_burst(w);
+      } else
+        while(!w->idle.empty() && w->connections - w->idle.size() < limit)
+          start_transaction(w, 0, -1);
+    }
+
+    // wait for socket activity, but no longer than curl's next
+    // timeout, the next transaction timer or the next scheduled
+    // arrival, and at most a second so we notice when to quit (or a
+    // tenth, with a profile, to keep up with its changes)
+    int max_wait = profile.empty() ? 1000 : 100, wait_ms = max_wait;
+    uint64_t deadline = w->curl_deadline;
+    if(!w->timers.empty() && (!deadline || w->timers.next() < deadline))
+      deadline = w->timers.next();
+    if(opt_rate > 0 && !w->idle.empty() && (!deadline || w->next_arrival < deadline))
+      deadline = w->next_arrival;
+    if(deadline) {
+      // (clamped before narrowing: a rate of 0's arrival is ~146 years
+      // off, which wouldn't fit in an int of ms)
+      uint64_t n = now_nsec(), ms = deadline <= n ? 0 : (deadline - n + 999999) / 1000000;
+      wait_ms = ms > (uint64_t)max_wait ? max_wait : int(ms);
+    }
+    nev = epoll_wait(w->epfd, events, max_events, wait_ms);
+    if(nev < 0) {
       if(errno == EINTR)
         continue;
-      mylog("error: select (%d)", errno);
-      return 1;
+      mylog(LOG_ERROR, "error: epoll_wait (%d)", errno);
+      exit(1);
     }
 
-    int total_transactions = T.size();
+    gauge(w->stats.transactions, w->connections - w->idle.size());
+
+    // run curl on just the sockets that are ready
+    for(int i = 0; i < nev; ++i) {
+      int mask = 0;
+      if(events[i].events & EPOLLIN)
+        mask |= CURL_CSELECT_IN;
+      if(events[i].events & EPOLLOUT)
+        mask |= CURL_CSELECT_OUT;
+      if(events[i].events & (EPOLLERR | EPOLLHUP))
+        mask |= CURL_CSELECT_ERR;
+      if(curl_multi_socket_action(w->curl, events[i].data.fd, mask, &running) != CURLM_OK) {
+        mylog(LOG_ERROR, "error: curl_multi_socket_action");
+        exit(1);
+      }
+    }
 
-    // run curl on transactions with data waiting
-    do {
-      rv = curl_multi_perform(curl, &running);
-      if(rv != CURLM_OK && rv != CURLM_CALL_MULTI_PERFORM) {
-        mylog("error: curl_multi_perform");
-        return 1;
+    // and let curl handle its timeouts
+    if(w->curl_deadline && w->curl_deadline <= now_nsec()) {
+      w->curl_deadline = 0;
+      if(curl_multi_socket_action(w->curl, CURL_SOCKET_TIMEOUT, 0, &running) != CURLM_OK) {
+        mylog(LOG_ERROR, "error: curl_multi_socket_action");
+        exit(1);
       }
-    } while(rv == CURLM_CALL_MULTI_PERFORM);
+    }
 
     // clean up completed transactions and do various tests
     struct CURLMsg *msg;
-    while((msg = curl_multi_info_read(curl, &rv))) {
+    while((msg = curl_multi_info_read(w->curl, &rv))) {
       if(msg == NULL) {
-        mylog("error: curl_multi_info_read");
-        return 1;
+        mylog(LOG_ERROR, "error: curl_multi_info_read");
+        exit(1);
       }
       if(msg->msg != CURLMSG_DONE)
         continue;
-      finish_transaction(msg->easy_handle, msg->data.result);
-      ++done_since_last;
-    }
-
-    // go through the transactions and simulate some stuff; skip this
-    // if none of the simulations are enabled since just the looping
-    // takes up a fair amount of CPU
-    int throttling = 0;
-    time_t now = time(0);
-    std::list<transaction_t>::iterator t = T.begin(), tmp;
-
-    if(opt_term_prob > 0 || opt_throttle_prob > 0) {
-      for(; t != T.end(); ++t) {
-      simulate_top:
-        // should we terminate this transaction early?
-        if(t->random_terminate_time && double(now - t->start) > t->random_terminate_time) {
-          if(!opt_quiet)
-            mylog("terminating request for %s after %d seconds", url[t->url_id].c_str(), now - t->start);
-          t->random_terminate_time = -1.0; // to notify finish_transaction
-          tmp = t;
-          ++t;
-          finish_transaction(tmp->curl, 0);
-          ++done_since_last;
-          if(t == T.end())
-            break;
-          goto simulate_top;
-        }
+      finish_transaction(w, msg->easy_handle, msg->data.result);
+      bump(w->stats.done);
+    }
 
-        // throttle, if necessary, by temporarily removing the
-        // transaction from the curl multi handle; if we are currently
-        // throttling, decide whether to reinstate the transaction
-        if(t->throttle_bytes_per_sec) {
-          if(!opt_no_checks) {
-            // compute bytes_sent from the file since we don't use a
-            // custom write function if we're saving the data
-            struct stat st;
-            fstat(fileno(t->outfile), &st);
-            t->bytes_sent = st.st_size;
-          }
-          double Bps = double(t->bytes_sent) / double(now - t->start);
-
-          if(!t->currently_throttling && Bps > t->throttle_bytes_per_sec) {
-            t->currently_throttling = true;
-            if(curl_multi_remove_handle(curl, t->curl) != CURLM_OK) {
-              mylog("error: murl_multi_remove_handle");
-              return 1;
-            }
-          } else if(t->currently_throttling && Bps <= t->throttle_bytes_per_sec) {
-            t->currently_throttling = false;
-            if(curl_multi_add_handle(curl, t->curl) != CURLM_OK) {
-              mylog("error: curl_multi_add_handle");
-              return 1;
-            }
-          }
-
-          if(t->currently_throttling)
-            ++throttling;
+    // run the timers that are due: early terminations, and resuming
+    // transfers that were paused for throttling
+    uint64_t now = now_nsec();
+    while(!w->timers.empty() && w->timers.next() <= now) {
+      unsigned int id = w->timers.pop();
+
+      if(id == cap_timer_id(w)) {
+        // the cap has room again; resume everything that was waiting
+        // for it, in the order they started waiting.  those that find
+        // it used up again get back in line.
+        std::vector<int> waiting;
+        waiting.swap(w->cap_waiting);
+        for(unsigned int i = 0; i < waiting.size(); ++i) {
+          transaction_t *t = &w->slots[waiting[i]];
+          t->waiting_for_cap = false;
+          resume(w, t);
         }
+        continue;
       }
+
+      transaction_t *t = &w->slots[id / TIMERS_PER_SLOT];
+      if(id % TIMERS_PER_SLOT == TIMER_TERMINATE) {
+        if(log_enabled(LOG_INFO))
+          mylog(LOG_INFO, "terminating request for %s after %.1f seconds", url_name(t->url_id),
+                (now - t->started) / 1e9);
+        t->random_terminate_time = -1.0; // to notify finish_transaction
+        finish_transaction(w, t->curl, 0);
+        bump(w->stats.done);
+      } else
+        resume(w, t);
     }
+    gauge(w->stats.throttling, w->throttled);
 
-    // print out status once per second
-    if(now - last_status > 0) {
-      done += done_since_last;
-      bytes += bytes_since_last;
-      if(opt_no_checks)
-        mylog("status: %d transfers, %d finished, %d throttling, ~%d req per sec, ~%d Bps download",
-              total_transactions, done, throttling, done_since_last, bytes_since_last);
+  }
+
+  for(unsigned int i = 0; i < w->handles.size(); ++i)
+    curl_easy_cleanup(w->handles[i]);
+  curl_easy_cleanup(w->template_handle);
+  curl_multi_cleanup(w->curl);
+  for(unsigned int i = 0; i < w->local_maps.size(); ++i)
+    if(w->local_maps[i].p)
+      munmap((void *)w->local_maps[i].p, w->local_maps[i].len);
+  delete [] w->slots;
+  for(unsigned int i = 0; i < w->bursts.size(); ++i)
+    delete [] w->bursts[i].url_string;
+  delete w->cache_rule_copy;
+  close(w->epfd);
+
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  parse_command_line(argc, argv);
+
+  // every transaction needs a socket (and an output file, when
+  // checking), so allow as many descriptors as the hard limit does
+  struct rlimit rl;
+  if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+    rl.rlim_cur = rl.rlim_max;
+    if(setrlimit(RLIMIT_NOFILE, &rl) < 0)
+      mylog(LOG_WARNING, "warning: can't raise descriptor limit (%d)", errno);
+  }
+
+  // curl's global state has to be set up before any threads start
+  if(curl_global_init(CURL_GLOBAL_ALL) != CURLE_OK) {
+    mylog(LOG_ERROR, "error: curl_global_init");
+    return 1;
+  }
+
+  // from here on, log lines are written out by a thread of their own
+  log_start();
+
+  metrics_server metrics;
+  if(opt_metrics_port) {
+    std::string error;
+    if(!metrics.start(opt_metrics_port, error)) {
+      mylog(LOG_ERROR, "error: metrics port %d: %s", opt_metrics_port, error.c_str());
+      return 1;
+    }
+  }
+
+  // set some signal handlers; mainly this is useful to exit normally
+  // (call "exit") on interruption so that profiler data is written
+  // properly for debugging and optimization.  the workers block these
+  // signals so they're always delivered to the main thread.
+  signal(SIGINT, quit);
+  signal(SIGQUIT, quit);
+  signal(SIGTERM, quit);
+  signal(SIGUSR1, change_log_level);
+  signal(SIGUSR2, change_log_level);
+  sigset_t sigs;
+  sigemptyset(&sigs);
+  sigaddset(&sigs, SIGINT);
+  sigaddset(&sigs, SIGQUIT);
+  sigaddset(&sigs, SIGTERM);
+  sigaddset(&sigs, SIGUSR1);
+  sigaddset(&sigs, SIGUSR2);
+  pthread_sigmask(SIG_BLOCK, &sigs, 0);
+
+  // split the transactions between the workers and start them up;
+  // each gets its own random sequence, and its own starting point in
+  // the URL list when requesting sequentially
+  long seed = opt_seed ? opt_seed : time(0);
+  if(log_enabled(LOG_INFO))
+    mylog(LOG_INFO, "random seed %ld", seed);
+  run_start = now_nsec();
+  traffic_mix mix = { opt_br_prob, opt_throttle_prob, opt_term_prob, opt_repeat_prob, opt_random_qstring_prob };
+  herd_nonce = (unsigned int)time(0) ^ ((unsigned int)getpid() << 16); // not from the seed: a repeated run needs new URLs
+  workers = new worker_t[opt_threads];
+  for(int i = 0; i < opt_threads; ++i) {
+    worker_t *w = &workers[i];
+    w->id = i;
+    w->connections = share(opt_connections, i);
+    w->limit = opt_adapt ? 1 : w->connections; // --adapt begins with one (see adapt_t)
+    w->arrival_mean = mean_gap(opt_rate);
+    use_mix(w, mix);
+    if(!profile.empty()) {
+      // the first phase's level and mix
+      if(profile.by_rate())
+        w->arrival_mean = mean_gap(profile[0].from);
       else
-        mylog("status: %d transfers, %d finished, %d throttling, ~%d req per sec",
-              total_transactions, done, throttling, done_since_last);
-      last_status = now;
-      done_since_last = 0;
-      bytes_since_last = 0;
+        w->limit = share(int(profile[0].from + 0.5), i);
+      use_mix(w, profile[0].mix);
+    }
+    w->cur_url = w->prev_url = (unsigned long)url_size * i / opt_threads;
+    long s = seed + i;
+    w->rng[0] = 0x330e;
+    w->rng[1] = s & 0xffff;
+    w->rng[2] = (s >> 16) & 0xffff;
+    if((opt_server_stats || opt_metrics_port) && !servers.empty())
+      w->server_stats = new worker_t::server_stats_t[servers.size()]();
+    if(opt_cache_stats)
+      w->cache_stats = new worker_t::cache_stats_t[CACHE_VERDICTS]();
+    if(opt_herd)
+      w->herd_stats = new worker_t::herd_stats_t();
+    if(pthread_create(&w->thread, 0, run_worker, w) != 0) {
+      mylog(LOG_ERROR, "error: pthread_create");
+      return 1;
+    }
+  }
+  pthread_sigmask(SIG_UNBLOCK, &sigs, 0);
+
+  // print out status every --status-interval, on the monotonic clock,
+  // answering requests for the metrics page in between;
+  // rates are over the time that actually went by since the last
+  // status line.  latency is reported for the transfers completed
+  // since the last status line, using the difference between
+  // successive snapshots of the histograms
+  unsigned long done = 0, bytes = 0, errors = 0;
+  adapt_t search;
+  std::vector<unsigned long> server_bytes(opt_server_stats ? servers.size() : 0);
+  histogram *lat_prev = new histogram[LAT_PHASES], *lat_cur = new histogram[LAT_PHASES];
+  cache_totals *cache_prev = 0, *cache_cur = 0, *cache_interval = 0;
+  if(opt_cache_stats) {
+    cache_prev = new cache_totals();
+    cache_cur = new cache_totals;
+    cache_interval = new cache_totals;
+  }
+  herd_totals *herd_prev = 0, *herd_cur = 0, *herd_interval = 0;
+  if(opt_herd) {
+    herd_prev = new herd_totals();
+    herd_cur = new herd_totals;
+    herd_interval = new herd_totals;
+  }
+  uint64_t interval = uint64_t(opt_status_interval * 1e9), last = now_nsec(), next = last;
+  steer_t *steering = 0;
+  if(!profile.empty()) {
+    steering = new steer_t;
+    steering->start = run_start;
+    mylog(LOG_STATUS, "phase %s begins", profile[0].name.c_str());
+  }
+  while(!quitting) {
+    next += interval;
+    if(steering) {
+      // steer the load on the way to the next status line
+      for(uint64_t until = 0; until < next && !quitting; ) {
+        until = steer(*steering, now_nsec());
+        if(!quitting)
+          wait_until(metrics, until < next ? until : next);
+      }
+    } else
+      wait_until(metrics, next);
+    uint64_t now = now_nsec();
+    double secs = (now - last) / 1e9;
+    last = now;
+    if(next < now) // fell behind; don't try to catch up
+      next = now;
+
+    unsigned long total_transactions = 0, throttling = 0, now_done = 0, now_bytes = 0, late = 0, now_errors = 0;
+    for(int i = 0; i < opt_threads; ++i) {
+      total_transactions += peek(workers[i].stats.transactions);
+      throttling += peek(workers[i].stats.throttling);
+      late += peek(workers[i].stats.late);
+      now_done += peek(workers[i].stats.done);
+      now_bytes += peek(workers[i].stats.bytes);
+      for(int j = TRACE_TRANSFER_ERROR; j < TRACE_RESULTS; ++j)
+        now_errors += peek(workers[i].outcomes.results[j]);
+    }
+    unsigned long done_since_last = (unsigned long)((now_done - done) / secs + 0.5);
+    unsigned long bytes_since_last = (unsigned long)((now_bytes - bytes) / secs + 0.5);
+    unsigned long done_interval = now_done - done, bytes_interval = now_bytes - bytes;
+    unsigned long errors_interval = now_errors - errors;
+    done = now_done;
+    bytes = now_bytes;
+    errors = now_errors;
+
+    if(opt_rate > 0)
+      mylog(LOG_STATUS, "status: %lu transfers, %lu finished, %lu throttling, ~%lu req per sec, ~%lu Bps download, "
+            "%lu started late", total_transactions, done, throttling, done_since_last, bytes_since_last, late);
+    else
+      mylog(LOG_STATUS, "status: %lu transfers, %lu finished, %lu throttling, ~%lu req per sec, ~%lu Bps download",
+            total_transactions, done, throttling, done_since_last, bytes_since_last);
+
+    latency_snapshot(lat_cur);
+    for(int p = 0; p < LAT_PHASES; ++p) {
+      histogram h = lat_cur[p];
+      lat_cur[p].subtract(lat_prev[p]);
+      lat_prev[p] = h;
+    }
+    log_latency("latency", lat_cur);
+
+    if(opt_adapt)
+      adapt(search, lat_cur[LAT_FIRST_BYTE], done_interval, bytes_interval, errors_interval, secs);
+
+    if(opt_server_stats)
+      log_server_stats(server_bytes, secs);
+
+    if(opt_cache_stats) {
+      cache_cur->snapshot();
+      *cache_interval = *cache_cur;
+      cache_interval->subtract(*cache_prev);
+      std::swap(cache_cur, cache_prev);
+      log_cache_stats(*cache_interval, false);
+    }
+
+    if(opt_herd) {
+      herd_cur->snapshot();
+      *herd_interval = *herd_cur;
+      herd_interval->subtract(*herd_prev);
+      std::swap(herd_cur, herd_prev);
+      log_herd_stats(*herd_interval, false);
     }
+  }
 
+  if(quitting < 0)
+    mylog(LOG_STATUS, "load profile finished, quitting");
+  else
+    mylog(LOG_STATUS, "received signal %d, quitting", (int)quitting);
+  if(steering && steering->phase < profile.size())
+    end_phase(*steering, now_nsec(), true);
+  for(int i = 0; i < opt_threads; ++i)
+    pthread_join(workers[i].thread, 0);
+
+  // and the whole run's latency
+  latency_snapshot(lat_cur);
+  log_latency("latency summary", lat_cur);
+  if(opt_adapt)
+    log_adapt_summary(search);
+  if(steering) {
+    for(unsigned int i = 0; i < steering->summaries.size(); ++i)
+      mylog(LOG_STATUS, "phase summary: %s", steering->summaries[i].c_str());
+    delete steering;
+  }
+  if(opt_cache_stats) {
+    cache_cur->snapshot();
+    log_cache_stats(*cache_cur, true);
+  }
+  if(opt_herd) {
+    herd_cur->snapshot();
+    log_herd_stats(*herd_cur, true);
   }
+  delete [] lat_prev;
+  delete [] lat_cur;
+  delete cache_prev;
+  delete cache_cur;
+  delete cache_interval;
+  delete herd_prev;
+  delete herd_cur;
+  delete herd_interval;
+  for(int i = 0; i < opt_threads; ++i) {
+    delete [] workers[i].server_stats;
+    delete [] workers[i].cache_stats;
+    delete workers[i].herd_stats;
+  }
+  delete [] workers;
 
-  curl_multi_cleanup(curl);
+  curl_global_cleanup();
 
   return 0;
 }
@@ -783,7 +2610,7 @@ int file_to_string_vector(const char *file, std::vector<std::string> &lines)
 {
   FILE *f = fopen(file, "r");
   if(!f)
-    return 1;
+    return -1;
   char line[1024], *nl;
   while(fgets(line, 1024, f)) {
     nl = strchr(line, '\n');
@@ -796,6 +2623,64 @@ int file_to_string_vector(const char *file, std::vector<std::string> &lines)
   return 0;
 }
 
+// finding the local files' sizes, a piece at a time (see
+// parallel_for)
+struct stat_job
+{
+  size_t missing, first_missing; // 1 + the index of one that's missing
+};
+
+void stat_locals(size_t begin, size_t end, void *arg)
+{
+  stat_job *j = (stat_job *)arg;
+  char local_buf[PATH_MAX];
+  struct stat st;
+  size_t missing = 0;
+  for(size_t i = begin; i < end; ++i) {
+    if(stat(local_name(i, local_buf), &st) < 0) {
+      object_sizes[i] = -1;
+      if(!missing++)
+        __atomic_store_n(&j->first_missing, i + 1, __ATOMIC_RELAXED);
+    } else
+      object_sizes[i] = st.st_size;
+  }
+  __atomic_fetch_add(&j->missing, missing, __ATOMIC_RELAXED);
+}
+
+// parsing the size list, a piece at a time (see parallel_for)
+struct size_parse_job
+{
+  const line_file *sizes;
+  size_t bad;         // 1 + the index of a line that isn't a size, or 0
+};
+
+void parse_sizes(size_t begin, size_t end, void *arg)
+{
+  size_parse_job *j = (size_parse_job *)arg;
+  uint64_t size;
+  for(size_t i = begin; i < end; ++i) {
+    if(parse_size((*j->sizes)[i], size))
+      object_sizes[i] = size;
+    else
+      __atomic_store_n(&j->bad, i + 1, __ATOMIC_RELAXED);
+  }
+}
+
+// parsing the md5 list, a piece at a time (see parallel_for)
+struct md5_parse_job
+{
+  const line_file *hex;
+  size_t bad;         // 1 + the index of a line that isn't an md5, or 0
+};
+
+void parse_md5s(size_t begin, size_t end, void *arg)
+{
+  md5_parse_job *j = (md5_parse_job *)arg;
+  for(size_t i = begin; i < end; ++i)
+    if(!parse_md5((*j->hex)[i], md5[i].d))
+      __atomic_store_n(&j->bad, i + 1, __ATOMIC_RELAXED);
+}
+
 int parse_command_line(int argc, char **argv)
 {
   // set up commandline/configuration file options
@@ -806,13 +2691,46 @@ int parse_command_line(int argc, char **argv)
   options::add<std::string>("md5-list", "m", "File with MD5 sums for each URL", "Input", "");
   options::add<std::string>("local-list", "l", "File with local filenames for each URL", "Input", "");
   options::add<std::string>("server-list", 0, "File with server IPs and weights", "Input", "");
+  options::add<std::string>("size-list", 0, "File with the size of each URL's object, if there's no local list",
+                            "Input", "");
+  options::add<bool>("synthetic", 0, "The objects were made by testclient-synth; check them against that",
+                     "Input", false);
+  options::add<int>("synthetic-key", 0, "Corpus key the synthetic objects were made with", "Input", 0);
+  options::add<int>("local-files", 0, "Idle local files each thread keeps mapped for verifying byte ranges",
+                    "Input", 64);
 
   options::add<int>("num-transactions", "n", "Number of simultaneous transactions to maintain",
                     "Traffic simulation", 80);
+  options::add<int>("threads", 0, "Number of worker threads to split the transactions between",
+                    "Traffic simulation", 1);
+  options::add<double>("rate", 0, "Open loop: start this many requests per second, up to num-transactions at once",
+                       "Traffic simulation", 0.0);
+  options::add<bool>("poisson", 0, "Open loop: Poisson arrivals rather than evenly spaced ones",
+                     "Traffic simulation", false);
+  options::add<bool>("adapt", 0, "Search for the most transactions (up to num-transactions) the servers take "
+                     "within the adapt-p99 and adapt-error-rate limits", "Traffic simulation", false);
+  options::add<double>("adapt-p99", 0, "Adaptive: limit on the p99 time to first byte, ms (0 = none)",
+                       "Traffic simulation", 0.0);
+  options::add<double>("adapt-error-rate", 0, "Adaptive: limit on the fraction of requests that fail",
+                       "Traffic simulation", 0.01);
+  options::add<std::string>("profile", 0, "File of timed load phases to run through, then stop (see loadprofile.hpp)",
+                            "Traffic simulation", "");
   options::add<bool>("reuse-connections", "u", "Keep connections open and reuse them for new requests",
                      "Traffic simulation", false);
   options::add<bool>("random", "r", "Request URLs in random order (default)", "Traffic simulation", true);
   options::add<bool>("sequential", "s", "Request URLs in sequential order", "Traffic simulation", false);
+  options::add<std::string>("popularity", 0, "URL popularity for random order: uniform, zipf, weights or hotset",
+                            "Traffic simulation", "uniform");
+  options::add<double>("zipf-alpha", 0, "Zipf popularity: exponent (the Nth URL is requested ~1/N^alpha as often)",
+                       "Traffic simulation", 1.0);
+  options::add<std::string>("url-weights", 0, "Weights popularity: file with a weight for each URL",
+                            "Traffic simulation", "");
+  options::add<double>("hot-fraction", 0, "Hotset popularity: fraction of the URLs (from the top of the list) that are hot",
+                       "Traffic simulation", 0.1);
+  options::add<double>("hot-prob", 0, "Hotset popularity: probability of requesting a hot URL",
+                       "Traffic simulation", 0.9);
+  options::add<int>("seed", 0, "Random seed, to repeat a run's request sequence (0 = use the time)",
+                    "Traffic simulation", 0);
   options::add<double>("random-qstring-prob", 0, "Probability of adding a random query string parameter to the URL",
                        "Traffic simulation", 0.0);
   options::add<double>("br-prob", "b", "Probability of making a byte range request (requires local-list)",
@@ -823,6 +2741,8 @@ int parse_command_line(int argc, char **argv)
                     "Traffic simulation", 10000000);
   options::add<int>("throttle-max", "a", "Randomized throttling: maximum bytes/sec",
                     "Traffic simulation", 10000000);
+  options::add<double>("max-bandwidth", 0, "Cap on the total download rate, bytes/sec (0 = none)",
+                       "Traffic simulation", 0.0);
   options::add<double>("term-prob", "t", "Probability of considering early termination for a request",
                        "Traffic simulation", 0.0);
   options::add<double>("term-min-sec", "e", "Seconds before we start considering early termination",
@@ -832,13 +2752,33 @@ int parse_command_line(int argc, char **argv)
                        "Traffic simulation", 30.0);
   options::add<double>("repeat-prob", "p", "Probability of the previous request being repeated immediately",
                        "Traffic simulation", 0.0);
+  options::add<int>("herd", 0, "Thundering herd: request each cold URL this many times at once (0 = don't)",
+                    "Traffic simulation", 0);
 
   options::add<bool>("verbose", "v", "Dump lots of debug output on request failure",
                      "Output", false);
   options::add<bool>("no-checks", "x", "Don't do any consistency checking; dump content to /dev/null",
                      "Output", false);
+  options::add<int>("save-bytes", 0, "Bytes at the end of each response to keep for saving if its check fails "
+                    "(0 = none; costs this much memory per transaction, and a copy of what arrives)",
+                    "Output", 0);
+  options::add<int>("metrics-port", 0, "Serve live metrics for Prometheus at http://host:port/metrics (0 = don't)",
+                    "Output", 0);
+  options::add<double>("status-interval", 0, "Seconds between status lines (e.g. 0.1)", "Output", 1.0);
+  options::add<bool>("server-stats", 0, "Log requests, errors and download rate for each server with the status",
+                     "Output", false);
+  options::add<bool>("cache-stats", 0, "Tell cache hits from misses by the response headers, and log the hit ratio",
+                     "Output", false);
+  options::add<std::string>("cache-rules", 0, "File of rules for --cache-stats, instead of the usual caches' headers",
+                            "Output", "");
+  options::add<std::string>("trace", 0, "Binary file to record every finished request in (see testclient-analyze)",
+                            "Output", "");
+  options::add<int>("trace-records", 0, "Requests the trace has room for; after that the oldest are overwritten",
+                    "Output", 1048576);
   options::add<bool>("quiet", "q", "Quiet: log only status information, errors, and nothing else",
                      "Output", false);
+  options::add<std::string>("log-level", 0, "Most verbose messages to log: error, warning, status or info",
+                            "Output", "info");
 
   int inpidx = options::parse_cmdline(argc, argv);
 
@@ -862,39 +2802,96 @@ int parse_command_line(int argc, char **argv)
       options::dump(conf);
   }
 
-  // read in URL list
-  if(file_to_string_vector(argv[inpidx], url) < 0) {
-    mylog("Can't read in %s", argv[inpidx]);
+  // a compiled workload (from testclient-compile) stands in for the
+  // URL, md5 and local file lists; otherwise map the URL list
+  if(workload::is_workload(argv[inpidx])) {
+    if(options::quickget<std::string>("md5-list").length() ||
+       options::quickget<std::string>("local-list").length()) {
+      mylog(LOG_ERROR, "MD5 and local file lists go into a compiled workload, not alongside it");
+      exit(1);
+    }
+    std::string error;
+    if(!compiled.load(argv[inpidx], error)) {
+      mylog(LOG_ERROR, "Can't read in %s: %s", argv[inpidx], error.c_str());
+      exit(1);
+    }
+    use_compiled = true;
+  } else if(!url.load(argv[inpidx])) {
+    mylog(LOG_ERROR, "Can't read in %s", argv[inpidx]);
     exit(1);
   }
 
-  // read in MD5 list
+  // read in MD5 list, keeping just the binary digests
   if(options::quickget<std::string>("md5-list").length()) {
-    if(file_to_string_vector(options::quickget<std::string>("md5-list").c_str(), md5) < 0) {
-      mylog("Can't read in %s", options::quickget<std::string>("md5-list").c_str());
+    line_file hex;
+    if(!hex.load(options::quickget<std::string>("md5-list").c_str())) {
+      mylog(LOG_ERROR, "Can't read in %s", options::quickget<std::string>("md5-list").c_str());
       exit(1);
     }
-    if(md5.size() != url.size()) {
-      mylog("MD5 list must be same size as URL list");
+    if(hex.size() != url.size()) {
+      mylog(LOG_ERROR, "MD5 list must be same size as URL list");
+      exit(1);
+    }
+    md5.resize(hex.size());
+    md5_parse_job j = { &hex, 0 };
+    parallel_for(hex.size(), 65536, parse_md5s, &j);
+    if(j.bad) {
+      mylog(LOG_ERROR, "Bad MD5 in %s: %.*s", options::quickget<std::string>("md5-list").c_str(),
+            (int)hex[j.bad - 1].len, hex[j.bad - 1].p);
       exit(1);
     }
   }
 
-  // read in local file list
+  // map the local file list
   if(options::quickget<std::string>("local-list").length()) {
-    if(file_to_string_vector(options::quickget<std::string>("local-list").c_str(), local) < 0) {
-      mylog("Can't read in %s", options::quickget<std::string>("local-list").c_str());
+    if(!local.load(options::quickget<std::string>("local-list").c_str())) {
+      mylog(LOG_ERROR, "Can't read in %s", options::quickget<std::string>("local-list").c_str());
       exit(1);
     }
     if(local.size() != url.size()) {
-      mylog("Local file list must be same size as URL list");
+      mylog(LOG_ERROR, "Local file list must be same size as URL list");
+      exit(1);
+    }
+
+    // look up all the sizes now rather than on every byte range
+    object_sizes.resize(local.size());
+    stat_job j = { 0, 0 };
+    parallel_for(local.size(), 1024, stat_locals, &j);
+    if(j.missing) {
+      char local_buf[PATH_MAX];
+      mylog(LOG_WARNING, "warning: %lu local files (such as %s) can't be found; they won't get byte range requests",
+            (unsigned long)j.missing, local_name(j.first_missing - 1, local_buf));
+    }
+  }
+
+  // read in the size list, which is for when there are no local files
+  std::string size_list = options::quickget<std::string>("size-list");
+  if(size_list.length()) {
+    if(use_compiled || !object_sizes.empty()) {
+      mylog(LOG_ERROR, "Sizes come from the local files or the compiled workload; no need for a size list too");
+      exit(1);
+    }
+    line_file sizes;
+    if(!sizes.load(size_list.c_str())) {
+      mylog(LOG_ERROR, "Can't read in %s", size_list.c_str());
+      exit(1);
+    }
+    if(sizes.size() != url.size()) {
+      mylog(LOG_ERROR, "Size list must be same size as URL list");
+      exit(1);
+    }
+    object_sizes.resize(sizes.size());
+    size_parse_job j = { &sizes, 0 };
+    parallel_for(sizes.size(), 65536, parse_sizes, &j);
+    if(j.bad) {
+      mylog(LOG_ERROR, "Bad size in %s: %.*s", size_list.c_str(), (int)sizes[j.bad - 1].len, sizes[j.bad - 1].p);
       exit(1);
     }
   }
 
   if(options::quickget<std::string>("server-list").length()) {
     if(file_to_string_vector(options::quickget<std::string>("server-list").c_str(), servers) < 0) {
-      mylog("Can't read in %s", options::quickget<std::string>("server-list").c_str());
+      mylog(LOG_ERROR, "Can't read in %s", options::quickget<std::string>("server-list").c_str());
       exit(1);
     }
 
@@ -914,37 +2911,247 @@ int parse_command_line(int argc, char **argv)
     }
     for(i = 0; i < server_weights.size(); ++i)
       server_weights[i] /= W; // normalize weights
+    server_choice.build(server_weights);
 
-    // we've got servers, convert urls into paths and put the host
-    // names in a separate vector
+    // we've got servers, narrow the urls to their paths and put the
+    // host names in a separate vector (a compiled workload has them
+    // split already)
+    hosts.resize(url.size());
     for(i = 0; i < url.size(); ++i) {
-      url[i].erase(0, 7); // assume all the urls start with 'http://'
-      size_t sl = url[i].find_first_of("/");
-      hosts.push_back(url[i].substr(0, sl));
-      url[i].erase(0, sl);
+      line_t &u = url[i];
+      unsigned int skip = u.len < 7 ? u.len : 7; // assume all the urls start with 'http://'
+      const char *sl = (const char *)memchr(u.p + skip, '/', u.len - skip);
+      unsigned int host_len = sl ? sl - u.p - skip : u.len - skip;
+      hosts[i].p = u.p + skip;
+      hosts[i].len = host_len;
+      u.p += skip + host_len;
+      u.len -= skip + host_len;
     }
   }
 
-  url_size = url.size();
-  md5_size = md5.size();
-  local_size = local.size();
+  unsigned int longest = 0, i;
+  if(use_compiled) {
+    url_size = compiled.size();
+    md5_size = compiled.has_md5s() ? url_size : 0;
+    local_size = compiled.has_locals() ? url_size : 0;
+    longest = compiled.longest_path();
+    if(servers.empty())
+      longest += 7 + compiled.longest_host();
+  } else {
+    url_size = url.size();
+    md5_size = md5.size();
+    local_size = local.size();
+    for(i = 0; i < url_size; ++i)
+      if(url[i].len > longest)
+        longest = url[i].len;
+  }
+
+  // size the per-transaction URL buffers: 'http://' + server + path +
+  // a random query string, if there are servers, else URL + query string
+  url_string_size = longest + 32;
+  if(!servers.empty()) {
+    unsigned int longest_server = 0;
+    for(i = 0; i < servers.size(); ++i)
+      if(servers[i].length() > longest_server)
+        longest_server = servers[i].length();
+    url_string_size += 7 + longest_server;
+  }
 
   opt_reuse = options::quickget<bool>("reuse-connections");
   opt_random = !options::quickget<bool>("sequential");
   opt_connections = options::quickget<int>("num-transactions");
-  opt_br_prob = local_size == url_size ? options::quickget<double>("br-prob") : 0.0;
+  opt_br_prob = have_object_sizes() ? options::quickget<double>("br-prob") : 0.0;
   opt_throttle_prob = options::quickget<double>("throttle-prob");
   opt_throttle_min = options::quickget<int>("throttle-min");
   opt_throttle_max = options::quickget<int>("throttle-max");
+  opt_max_bandwidth = options::quickget<double>("max-bandwidth");
   opt_term_prob = options::quickget<double>("term-prob");
   opt_term_min_sec = options::quickget<double>("term-min-sec");
-  opt_term_weibull_k = options::quickget<double>("term-min-weibull-k");
-  opt_term_weibull_lambda = options::quickget<double>("term-min-weibull-lambda");
+  opt_term_weibull_k = options::quickget<double>("term-weibull-k");
+  opt_term_weibull_lambda = options::quickget<double>("term-weibull-lambda");
   opt_repeat_prob = options::quickget<double>("repeat-prob");
   opt_verbose = options::quickget<bool>("verbose");
   opt_no_checks = options::quickget<bool>("no-checks");
-  opt_quiet = options::quickget<bool>("quiet");
+  std::string level = options::quickget<std::string>("log-level");
+  if(level == "error")
+    log_set_level(LOG_ERROR);
+  else if(level == "warning")
+    log_set_level(LOG_WARNING);
+  else if(level == "status")
+    log_set_level(LOG_STATUS);
+  else if(level == "info")
+    log_set_level(LOG_INFO);
+  else {
+    mylog(LOG_ERROR, "Unknown log level %s", level.c_str());
+    exit(1);
+  }
+  if(options::quickget<bool>("quiet") && log_level > LOG_STATUS)
+    log_set_level(LOG_STATUS);
   opt_random_qstring_prob = options::quickget<double>("random-qstring-prob");
+  opt_threads = options::quickget<int>("threads");
+  opt_save_bytes = options::quickget<int>("save-bytes");
+  opt_rate = options::quickget<double>("rate");
+  opt_poisson = options::quickget<bool>("poisson");
+  opt_adapt = options::quickget<bool>("adapt");
+  opt_adapt_p99 = options::quickget<double>("adapt-p99");
+  opt_adapt_error_rate = options::quickget<double>("adapt-error-rate");
+  if(opt_adapt && opt_rate > 0) {
+    mylog(LOG_ERROR, "The adaptive search is for the closed loop; --rate sets the load itself");
+    exit(1);
+  }
+  std::string profile_name = options::quickget<std::string>("profile");
+  if(!profile_name.empty()) {
+    if(opt_adapt) {
+      mylog(LOG_ERROR, "The adaptive search and a load profile can't both set the load");
+      exit(1);
+    }
+    std::string error;
+    traffic_mix mix = { opt_br_prob, opt_throttle_prob, opt_term_prob, opt_repeat_prob, opt_random_qstring_prob };
+    if(!profile.load(profile_name.c_str(), opt_connections, opt_rate, mix, error)) {
+      mylog(LOG_ERROR, "Can't read in %s: %s", profile_name.c_str(), error.c_str());
+      exit(1);
+    }
+    // a rate profile runs open loop, with -n still capping what's in
+    // flight; a transactions profile needs a slot for its peak
+    if(profile.by_rate()) {
+      opt_rate = profile.max_level();
+      if(opt_rate <= 0) {
+        mylog(LOG_ERROR, "A rate profile has to ask for some requests");
+        exit(1);
+      }
+    } else if(profile.max_level() > opt_connections)
+      opt_connections = int(ceil(profile.max_level()));
+  }
+  opt_seed = options::quickget<int>("seed");
+  opt_server_stats = options::quickget<bool>("server-stats") && !servers.empty();
+  opt_status_interval = options::quickget<double>("status-interval");
+  opt_metrics_port = options::quickget<int>("metrics-port");
+  std::string cache_rules_name = options::quickget<std::string>("cache-rules");
+  opt_cache_stats = options::quickget<bool>("cache-stats") || !cache_rules_name.empty();
+  if(!cache_rules_name.empty()) {
+    std::string error;
+    if(!cache_rule_set.load(cache_rules_name.c_str(), error)) {
+      mylog(LOG_ERROR, "Can't read in %s: %s", cache_rules_name.c_str(), error.c_str());
+      exit(1);
+    }
+  } else if(opt_cache_stats)
+    cache_rule_set.defaults();
+  if(opt_status_interval <= 0.0) {
+    mylog(LOG_ERROR, "Status interval must be positive");
+    exit(1);
+  }
+  log_millis = opt_status_interval < 1.0;
+  std::string trace_name = options::quickget<std::string>("trace");
+  if(!trace_name.empty()) {
+    std::string error;
+    if(!trace.create(trace_name.c_str(), options::quickget<int>("trace-records"), error)) {
+      mylog(LOG_ERROR, "Can't create %s: %s", trace_name.c_str(), error.c_str());
+      exit(1);
+    }
+  }
+  opt_local_files = options::quickget<int>("local-files");
+  opt_synthetic = options::quickget<bool>("synthetic");
+  opt_synthetic_key = (unsigned int)options::quickget<int>("synthetic-key");
+  if(opt_synthetic && (md5_size || local_size)) {
+    mylog(LOG_ERROR, "Synthetic objects are checked without MD5 or local file lists");
+    exit(1);
+  }
+  opt_zipf_alpha = options::quickget<double>("zipf-alpha");
+  opt_hot_fraction = options::quickget<double>("hot-fraction");
+  opt_hot_prob = options::quickget<double>("hot-prob");
+
+  // set up the popularity model
+  std::string pop = options::quickget<std::string>("popularity");
+  if(pop == "uniform")
+    opt_popularity = POP_UNIFORM;
+  else if(pop == "zipf") {
+    opt_popularity = POP_ZIPF;
+    std::vector<double> weights(url_size);
+    for(i = 0; i < url_size; ++i)
+      weights[i] = pow(i + 1.0, -opt_zipf_alpha);
+    url_popularity.build(weights);
+  } else if(pop == "weights") {
+    opt_popularity = POP_WEIGHTS;
+    std::string wfname = options::quickget<std::string>("url-weights");
+    std::vector<double> weights;
+    weights.reserve(url_size);
+    if(wfname.empty() && use_compiled && compiled.has_weights()) {
+      // use the weights compiled into the workload
+      for(i = 0; i < url_size; ++i)
+        weights.push_back(compiled.weight(i));
+    } else {
+      FILE *f = fopen(wfname.c_str(), "r");
+      if(!f) {
+        mylog(LOG_ERROR, "Can't read in %s", wfname.c_str());
+        exit(1);
+      }
+      double d;
+      while(fscanf(f, "%lf", &d) == 1)
+        weights.push_back(d);
+      fclose(f);
+    }
+    if(weights.size() != url_size) {
+      mylog(LOG_ERROR, "URL weights list must be same size as URL list");
+      exit(1);
+    }
+    if(!url_popularity.build(weights)) {
+      mylog(LOG_ERROR, "URL weights must not all be zero");
+      exit(1);
+    }
+  } else if(pop == "hotset") {
+    opt_popularity = POP_HOTSET;
+    hot_size = (unsigned int)(opt_hot_fraction * url_size);
+    if(hot_size < 1)
+      hot_size = 1;
+    if(hot_size >= url_size) // everything is hot
+      opt_popularity = POP_UNIFORM;
+  } else {
+    mylog(LOG_ERROR, "Unknown popularity model %s", pop.c_str());
+    exit(1);
+  }
+
+  if(opt_threads < 1) {
+    mylog(LOG_ERROR, "Need at least one thread");
+    exit(1);
+  }
+  if(opt_connections < 1) {
+    mylog(LOG_ERROR, "Need at least one transaction");
+    exit(1);
+  }
+  if(opt_threads > opt_connections) {
+    // a thread without a slot would still take its share of the
+    // --rate arrivals, and never send them
+    mylog(LOG_WARNING, "warning: only %d transactions for %d threads; using %d threads",
+          opt_connections, opt_threads, opt_connections);
+    opt_threads = opt_connections;
+  }
+
+  opt_herd = options::quickget<int>("herd");
+  if(opt_herd) {
+    if(opt_herd < 2) {
+      mylog(LOG_ERROR, "A herd takes at least two requests");
+      exit(1);
+    }
+    if(opt_rate > 0) {
+      mylog(LOG_ERROR, "Herds are started in the closed loop; --rate doesn't apply");
+      exit(1);
+    }
+    if(opt_adapt) {
+      mylog(LOG_ERROR, "The adaptive search starts one transaction per thread, less than a herd");
+      exit(1);
+    }
+    if(opt_connections / opt_threads < opt_herd) {
+      mylog(LOG_ERROR, "Each thread needs at least --herd transactions (-n) for a burst");
+      exit(1);
+    }
+    if(url_size < (unsigned int)opt_threads) {
+      mylog(LOG_ERROR, "Each thread needs some URLs of its own for a herd");
+      exit(1);
+    }
+  }
+
+  if(opt_local_files < 1)
+    opt_local_files = 1;
 
   if(opt_no_checks)
     opt_verbose = false;
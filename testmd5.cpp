@@ -36,10 +36,9 @@ void md5_compute(FILE *f, int start, int end, std::string &md5)
   static unsigned char data[102400]; // 100K buffer to read from file
   static unsigned char md_val[EVP_MAX_MD_SIZE];
   unsigned int md_len;
-  EVP_MD_CTX mdctx;
+  EVP_MD_CTX *mdctx = EVP_MD_CTX_create();
   const EVP_MD *md = EVP_md5();
-  EVP_MD_CTX_init(&mdctx);
-  EVP_DigestInit_ex(&mdctx, md, NULL);
+  EVP_DigestInit_ex(mdctx, md, NULL);
 
   // read data in chunks from the file and update the digest
   size_t rv;
@@ -51,13 +50,13 @@ void md5_compute(FILE *f, int start, int end, std::string &md5)
     rv = fread(data, 1, rv, f);
     if(rv == 0)
       break;
-    EVP_DigestUpdate(&mdctx, data, rv);
+    EVP_DigestUpdate(mdctx, data, rv);
     start += rv;
   } while(start <= end);
 
   // finalize the digest
-  EVP_DigestFinal_ex(&mdctx, md_val, &md_len);
-  EVP_MD_CTX_cleanup(&mdctx);
+  EVP_DigestFinal_ex(mdctx, md_val, &md_len);
+  EVP_MD_CTX_destroy(mdctx);
 
   // output
   md5.reserve(64);
@@ -0,0 +1,121 @@
+/*
+  Copyright 2008-2013 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*!
+  \file timers.cpp
+
+  \brief Deadline heap: implementation details.
+ */
+
+#include "timers.hpp"
+
+void timer_heap::init(unsigned int n)
+{
+  heap.clear();
+  heap.reserve(n);
+  pos.assign(n, -1);
+}
+
+void timer_heap::place(unsigned int i, const entry &e)
+{
+  heap[i] = e;
+  pos[e.id] = i;
+}
+
+void timer_heap::up(unsigned int i)
+{
+  entry e = heap[i];
+  while(i > 0) {
+    unsigned int parent = (i - 1) / 2;
+    if(heap[parent].when <= e.when)
+      break;
+    place(i, heap[parent]);
+    i = parent;
+  }
+  place(i, e);
+}
+
+void timer_heap::down(unsigned int i)
+{
+  entry e = heap[i];
+  unsigned int n = heap.size();
+  for(;;) {
+    unsigned int child = 2 * i + 1;
+    if(child >= n)
+      break;
+    if(child + 1 < n && heap[child + 1].when < heap[child].when)
+      ++child;
+    if(e.when <= heap[child].when)
+      break;
+    place(i, heap[child]);
+    i = child;
+  }
+  place(i, e);
+}
+
+void timer_heap::remove_at(unsigned int i)
+{
+  pos[heap[i].id] = -1;
+  entry last = heap.back();
+  heap.pop_back();
+  if(i == heap.size())
+    return;
+  // the last entry fills the hole, and may belong above or below it
+  place(i, last);
+  if(i > 0 && heap[(i - 1) / 2].when > last.when)
+    up(i);
+  else
+    down(i);
+}
+
+void timer_heap::set(unsigned int id, uint64_t when)
+{
+  if(pos[id] >= 0) {
+    unsigned int i = pos[id];
+    uint64_t old = heap[i].when;
+    heap[i].when = when;
+    if(when < old)
+      up(i);
+    else
+      down(i);
+    return;
+  }
+  entry e = { when, id };
+  heap.push_back(e);
+  up(heap.size() - 1);
+}
+
+void timer_heap::cancel(unsigned int id)
+{
+  if(pos[id] >= 0)
+    remove_at(pos[id]);
+}
+
+unsigned int timer_heap::pop()
+{
+  unsigned int id = heap[0].id;
+  remove_at(0);
+  return id;
+}
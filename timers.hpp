@@ -0,0 +1,80 @@
+/*
+  Copyright 2008-2013 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*!
+  \file timers.hpp
+
+  \brief A min-heap of deadlines for a fixed set of timer ids, with
+  each id's position tracked so a timer can be moved or cancelled in
+  O(log n) without leaving a stale entry behind.  Finding the next
+  deadline is O(1), and running the ones that are due touches nothing
+  else.
+
+  Times are whatever the caller uses (we use the monotonic clock, in
+  nanoseconds); a timer is only ever in the heap once.
+ */
+
+#ifndef _TIMERS_HPP
+#define _TIMERS_HPP
+
+#include <stdint.h>
+#include <vector>
+
+class timer_heap
+{
+public:
+  // make room for ids [0, n), none of them set
+  void init(unsigned int n);
+
+  // (re)arm timer id to go off at when
+  void set(unsigned int id, uint64_t when);
+
+  // disarm timer id, if it's set
+  void cancel(unsigned int id);
+
+  bool empty() const { return heap.empty(); }
+
+  // the earliest deadline; the heap mustn't be empty
+  uint64_t next() const { return heap[0].when; }
+
+  // remove the earliest timer and return its id
+  unsigned int pop();
+
+private:
+  struct entry {
+    uint64_t when;
+    unsigned int id;
+  };
+
+  void place(unsigned int i, const entry &e);
+  void up(unsigned int i);
+  void down(unsigned int i);
+  void remove_at(unsigned int i);
+
+  std::vector<entry> heap;
+  std::vector<int> pos; // where each id is in the heap, or -1
+};
+
+#endif // _TIMERS_HPP
@@ -0,0 +1,162 @@
+/*
+  Copyright 2008-2013 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*!
+  \file trace.cpp
+
+  \brief Binary trace files: implementation details.
+ */
+
+#include "trace.hpp"
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+trace_file::trace_file()
+{
+  h = 0;
+  records = 0;
+  map_len = 0;
+}
+
+trace_file::~trace_file()
+{
+  close();
+}
+
+void trace_file::close()
+{
+  if(h)
+    munmap(h, map_len);
+  h = 0;
+  records = 0;
+  map_len = 0;
+}
+
+bool trace_file::create(const char *file, uint64_t capacity, std::string &error)
+{
+  close();
+  if(capacity == 0) {
+    error = "no room for any records";
+    return false;
+  }
+  int fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0) {
+    error = strerror(errno);
+    return false;
+  }
+  // the slots are left as a hole until they're written, so a big ring
+  // that a short run doesn't fill costs no disk
+  map_len = sizeof(trace_header) + capacity * sizeof(trace_record);
+  if(ftruncate(fd, map_len) < 0) {
+    error = strerror(errno);
+    ::close(fd);
+    return false;
+  }
+  void *p = mmap(0, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if(p == MAP_FAILED) {
+    error = strerror(errno);
+    return false;
+  }
+
+  h = (trace_header *)p;
+  records = (trace_record *)(h + 1);
+  memcpy(h->magic, TRACE_MAGIC, sizeof(h->magic));
+  h->version = TRACE_VERSION;
+  h->byte_order = TRACE_BYTE_ORDER;
+  h->record_size = sizeof(trace_record);
+  h->capacity = capacity;
+  h->count = 0;
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  h->start_time = int64_t(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+  return true;
+}
+
+bool trace_file::load(const char *file, std::string &error)
+{
+  close();
+  int fd = open(file, O_RDONLY);
+  if(fd < 0) {
+    error = strerror(errno);
+    return false;
+  }
+  struct stat st;
+  if(fstat(fd, &st) < 0 || size_t(st.st_size) < sizeof(trace_header)) {
+    error = "too short to be a trace";
+    ::close(fd);
+    return false;
+  }
+  map_len = st.st_size;
+  void *p = mmap(0, map_len, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if(p == MAP_FAILED) {
+    error = strerror(errno);
+    return false;
+  }
+
+  h = (trace_header *)p;
+  records = (trace_record *)(h + 1);
+  if(memcmp(h->magic, TRACE_MAGIC, sizeof(h->magic)))
+    error = "not a trace";
+  else if(h->byte_order != TRACE_BYTE_ORDER)
+    error = "written on a machine with a different byte order";
+  else if(h->version != TRACE_VERSION || h->record_size != sizeof(trace_record))
+    error = "written by a different version of testclient";
+  else if(map_len < sizeof(trace_header) + h->capacity * sizeof(trace_record))
+    error = "truncated";
+  else
+    return true;
+  close();
+  return false;
+}
+
+void trace_file::append(const trace_record &r)
+{
+  uint64_t n = __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+  trace_record *slot = &records[n % h->capacity];
+  __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy((char *)slot + sizeof(slot->seq), (const char *)&r + sizeof(r.seq), sizeof(r) - sizeof(r.seq));
+  __atomic_store_n(&slot->seq, n + 1, __ATOMIC_RELEASE);
+}
+
+uint64_t trace_file::size() const
+{
+  return h->count < h->capacity ? h->count : h->capacity;
+}
+
+bool trace_file::get(uint64_t i, trace_record &r) const
+{
+  uint64_t n = h->count - size() + i; // the record number
+  r = records[n % h->capacity];
+  return r.seq == n + 1;
+}
@@ -0,0 +1,144 @@
+/*
+  Copyright 2008-2013 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*!
+  \file trace.hpp
+
+  \brief Binary trace files: one fixed-size record per finished
+  transaction (what was asked for, what came back, how long each phase
+  took and whether it checked out), for testclient-analyze to pick
+  apart after a run.
+
+  The file is a header followed by a ring of record slots, mapped
+  into memory by testclient.  Writers claim the next record number
+  with an atomic increment and fill in slot number % capacity, so the
+  file never grows: once it's full, each record replaces the oldest.
+  A record's seq (its number + 1) is stored last, and cleared before
+  the slot is overwritten, so a reader can tell a finished record from
+  one that was being written when the run died.  Times are in
+  microseconds (at most UINT32_MAX; see trace_usec()), except start,
+  which is nanoseconds since the run began.  Everything is in the writer's byte order.
+ */
+
+#ifndef _TRACE_HPP
+#define _TRACE_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+#define TRACE_MAGIC "tctrace\n"
+#define TRACE_VERSION 1
+#define TRACE_BYTE_ORDER 0x01020304
+
+struct trace_header
+{
+  char magic[8];
+  uint32_t version, byte_order;
+  uint32_t record_size, pad;
+  uint64_t capacity;       // record slots
+  uint64_t count;          // records ever claimed (atomic)
+  int64_t start_time;      // wall clock at the start of the run, ns since the epoch
+  uint64_t reserved[3];
+};
+
+// how a transaction's check came out
+enum { TRACE_UNCHECKED, TRACE_OK, TRACE_TRANSFER_ERROR, TRACE_CONTENT_ERROR,
+       TRACE_SIZE_ERROR, TRACE_MD5_ERROR, TRACE_RESULTS };
+
+// flags
+enum {
+  TRACE_TERMINATED = 1,    // terminated early on purpose
+  TRACE_THROTTLED = 2,     // shaped to throttle_rate
+  TRACE_RANGE = 4,         // a byte range request
+  TRACE_WHOLE_FILE = 8,    // ... that got the whole file
+  TRACE_LATE = 16,         // open loop: started behind schedule
+  TRACE_CACHE_HIT = 32,    // the cache rules (--cache-stats) called it a hit
+  TRACE_CACHE_MISS = 64    // ... or a miss
+};
+
+struct trace_record
+{
+  uint64_t seq;            // record number + 1, or 0 if unfinished
+  uint64_t start;          // when the transaction started
+  uint64_t bytes;          // content received
+  int32_t range_start, range_end;
+  uint32_t url_id;
+  int32_t server;          // index into the server list, or -1
+  uint32_t dns, connect, first_byte, total; // from the start of the transfer
+  uint32_t behind;         // open loop: how late it started
+  uint32_t throttle_rate;  // bytes/sec, if throttled
+  uint16_t status;         // HTTP response code
+  uint8_t curl_result;     // CURLcode
+  uint8_t result;          // TRACE_OK etc.
+  uint16_t flags;
+  uint16_t pad;
+};
+
+// a time for one of a record's 32-bit microsecond fields: anything
+// longer than they hold (about 71.6 minutes) is pinned at the most
+// rather than wrapped round to something small
+inline uint32_t trace_usec(uint64_t us)
+{
+  return us > UINT32_MAX ? UINT32_MAX : uint32_t(us);
+}
+
+class trace_file
+{
+public:
+  trace_file();
+  ~trace_file();
+
+  // make a new trace file with room for capacity records and map it
+  // for writing; on failure returns false and says why
+  bool create(const char *file, uint64_t capacity, std::string &error);
+
+  // map an existing trace file for reading
+  bool load(const char *file, std::string &error);
+
+  void close();
+  bool is_open() const { return h != 0; }
+
+  // add a record (its seq is filled in); safe from any thread
+  void append(const trace_record &r);
+
+  // the finished records still in the file, oldest first; i is from
+  // 0 to size() - 1, and get() returns false for a record that wasn't
+  // finished
+  uint64_t size() const;
+  bool get(uint64_t i, trace_record &r) const;
+
+  const trace_header & header() const { return *h; }
+
+private:
+  trace_file(const trace_file &);
+  trace_file & operator=(const trace_file &);
+
+  trace_header *h;
+  trace_record *records;
+  size_t map_len;
+};
+
+#endif // _TRACE_HPP
@@ -0,0 +1,169 @@
+/*
+  Copyright 2008-2013 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*!
+  \file workload.cpp
+
+  \brief Compiled workload files: mapping and checking them.
+ */
+
+#include "workload.hpp"
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+workload::workload()
+  : map(0), map_len(0), h(0), hosts(0), locals(0), urls(0), md5s(0), sizes(0), weights(0), strings(0)
+{
+}
+
+workload::~workload()
+{
+  if(map)
+    munmap(map, map_len);
+}
+
+bool workload::is_workload(const char *file)
+{
+  char magic[8];
+  int fd = open(file, O_RDONLY);
+  if(fd < 0)
+    return false;
+  bool yes = read(fd, magic, sizeof(magic)) == sizeof(magic) && !memcmp(magic, WORKLOAD_MAGIC, sizeof(magic));
+  close(fd);
+  return yes;
+}
+
+bool workload::load(const char *file, std::string &error)
+{
+  int fd = open(file, O_RDONLY);
+  if(fd < 0) {
+    error = strerror(errno);
+    return false;
+  }
+  struct stat st;
+  if(fstat(fd, &st) < 0 || size_t(st.st_size) < sizeof(workload_header)) {
+    error = "too short to be a workload";
+    close(fd);
+    return false;
+  }
+  map_len = st.st_size;
+  map = mmap(0, map_len, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED) {
+    map = 0;
+    error = strerror(errno);
+    return false;
+  }
+
+  h = (const workload_header *)map;
+  if(memcmp(h->magic, WORKLOAD_MAGIC, sizeof(h->magic))) {
+    error = "not a compiled workload";
+    return false;
+  }
+  if(h->byte_order != WORKLOAD_BYTE_ORDER) {
+    error = "compiled on a machine with a different byte order";
+    return false;
+  }
+  if(h->version != WORKLOAD_VERSION) {
+    error = "unsupported workload version";
+    return false;
+  }
+  if(h->file_size != map_len) {
+    error = "truncated";
+    return false;
+  }
+
+  // every section has to fit in the file; the refs inside them are
+  // trusted, since checking 50M of them would defeat the purpose
+  const char *base = (const char *)map;
+  struct { uint64_t off, len; } sections[] = {
+    { h->hosts, h->host_count * sizeof(workload_ref) },
+    { h->urls, h->url_count * sizeof(workload_url) },
+    { h->md5s, h->url_count * 16 },
+    { h->sizes, h->url_count * sizeof(uint64_t) },
+    { h->locals, h->url_count * sizeof(workload_ref) },
+    { h->weights, h->url_count * sizeof(double) },
+    { h->strings, h->strings_len }
+  };
+  for(unsigned int i = 0; i < sizeof(sections) / sizeof(sections[0]); ++i)
+    if(sections[i].off && (sections[i].off > map_len || sections[i].len > map_len - sections[i].off)) {
+      error = "section out of bounds";
+      return false;
+    }
+  if(!h->urls || !h->strings) {
+    error = "no URLs";
+    return false;
+  }
+
+  hosts = h->hosts ? (const workload_ref *)(base + h->hosts) : 0;
+  urls = (const workload_url *)(base + h->urls);
+  md5s = h->md5s ? (const unsigned char *)(base + h->md5s) : 0;
+  sizes = h->sizes ? (const uint64_t *)(base + h->sizes) : 0;
+  locals = h->locals ? (const workload_ref *)(base + h->locals) : 0;
+  weights = h->weights ? (const double *)(base + h->weights) : 0;
+  strings = base + h->strings;
+  return true;
+}
+
+static int hex_value(char c)
+{
+  if(c >= '0' && c <= '9')
+    return c - '0';
+  if(c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if(c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+bool parse_md5(const line_t &l, unsigned char *digest)
+{
+  if(l.len != 32)
+    return false;
+  for(unsigned int i = 0; i < 16; ++i) {
+    int hi = hex_value(l.p[2 * i]), lo = hex_value(l.p[2 * i + 1]);
+    if(hi < 0 || lo < 0)
+      return false;
+    digest[i] = (hi << 4) | lo;
+  }
+  return true;
+}
+
+bool parse_size(const line_t &l, uint64_t &size)
+{
+  if(l.len == 0 || l.len > 19)
+    return false;
+  size = 0;
+  for(unsigned int i = 0; i < l.len; ++i) {
+    if(l.p[i] < '0' || l.p[i] > '9')
+      return false;
+    size = size * 10 + (l.p[i] - '0');
+  }
+  return true;
+}
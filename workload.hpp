@@ -0,0 +1,157 @@
+/*
+  Copyright 2008-2013 Kristopher R Beevers and Internap Network
+  Services Corporation.
+
+  Permission is hereby granted, free of charge, to any person
+  obtaining a copy of this software and associated documentation files
+  (the "Software"), to deal in the Software without restriction,
+  including without limitation the rights to use, copy, modify, merge,
+  publish, distribute, sublicense, and/or sell copies of the Software,
+  and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+  BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+  ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+  CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/*!
+  \file workload.hpp
+
+  \brief Compiled workload files: the URL list, with its md5s, local
+  file names, object sizes and popularity weights, in one binary file
+  made by testclient-compile that testclient maps and uses as is.
+  Nothing is parsed or copied at startup, however many URLs there are,
+  and nothing about the objects has to be looked up on disk during a
+  run.
+
+  The file is a header followed by sections, each 8-byte aligned and
+  found by its offset in the header (0 if it's absent):
+
+    hosts    host_count workload_refs to the distinct host names
+    urls     url_count workload_urls: a host and the path on it
+    md5s     url_count 16-byte binary md5s
+    sizes    url_count 64-bit object sizes (of the local files, or
+             from a size list)
+    locals   url_count workload_refs to local file names
+    weights  url_count doubles
+    strings  the bytes the refs point into
+
+  A URL that didn't start with http:// has no host (host == no_host)
+  and keeps the whole URL as its path.  Everything is in the byte
+  order of the machine that compiled it; load() refuses files from
+  another byte order or format version.
+ */
+
+#ifndef _WORKLOAD_HPP
+#define _WORKLOAD_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include "linefile.hpp"
+
+#define WORKLOAD_MAGIC "tcwkld\n"
+#define WORKLOAD_VERSION 1
+#define WORKLOAD_BYTE_ORDER 0x01020304
+
+struct workload_header
+{
+  char magic[8];
+  uint32_t version, byte_order;
+  uint64_t url_count, host_count;
+  uint64_t hosts, urls, md5s, sizes, locals, weights, strings; // section offsets
+  uint64_t strings_len;
+  uint64_t file_size;
+  uint32_t longest_host, longest_path;
+};
+
+struct workload_ref
+{
+  uint64_t off; // into the strings section
+  uint32_t len, pad;
+};
+
+struct workload_url
+{
+  uint64_t path_off;
+  uint32_t path_len;
+  uint32_t host;   // index into hosts, or no_host
+  enum { no_host = 0xffffffff };
+};
+
+class workload
+{
+public:
+  workload();
+  ~workload();
+
+  // does the file start like a compiled workload?
+  static bool is_workload(const char *file);
+
+  // map a compiled workload; on failure returns false and says why
+  bool load(const char *file, std::string &error);
+
+  size_t size() const { return h ? h->url_count : 0; }
+  bool has_md5s() const { return md5s != 0; }
+  bool has_sizes() const { return sizes != 0; }
+  bool has_locals() const { return locals != 0; }
+  bool has_weights() const { return weights != 0; }
+  unsigned int longest_host() const { return h->longest_host; }
+  unsigned int longest_path() const { return h->longest_path; }
+
+  // the pieces of URL i; the host is empty if there isn't one
+  line_t host(size_t i) const
+  {
+    line_t l = { "", 0 };
+    if(urls[i].host != workload_url::no_host)
+      l = ref(hosts[urls[i].host]);
+    return l;
+  }
+  line_t path(size_t i) const
+  {
+    line_t l = { strings + urls[i].path_off, urls[i].path_len };
+    return l;
+  }
+  const unsigned char * md5(size_t i) const { return md5s + 16 * i; }
+  uint64_t object_size(size_t i) const { return sizes[i]; }
+  line_t local(size_t i) const { return ref(locals[i]); }
+  double weight(size_t i) const { return weights[i]; }
+
+private:
+  workload(const workload &);
+  workload & operator=(const workload &);
+
+  line_t ref(const workload_ref &r) const
+  {
+    line_t l = { strings + r.off, r.len };
+    return l;
+  }
+
+  void *map;
+  size_t map_len;
+  const workload_header *h;
+  const workload_ref *hosts, *locals;
+  const workload_url *urls;
+  const unsigned char *md5s;
+  const uint64_t *sizes;
+  const double *weights;
+  const char *strings;
+};
+
+// parse a line of an md5 list into a 16-byte digest; false unless
+// it's 32 hex digits
+bool parse_md5(const line_t &l, unsigned char *digest);
+
+// parse a line of a size list (a decimal number of bytes)
+bool parse_size(const line_t &l, uint64_t &size);
+
+#endif // _WORKLOAD_HPP